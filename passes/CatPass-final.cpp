@@ -3,10 +3,18 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Operator.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/CFG.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Local.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include "llvm/Analysis/DomTreeUpdater.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/PostOrderIterator.h"
 #include "llvm/ADT/SmallBitVector.h"
 #include "llvm/ADT/BitVector.h"
 #include "llvm/Support/raw_ostream.h"
@@ -32,16 +40,115 @@
 #include "llvm/Analysis/ScalarEvolutionExpressions.h"
 #include "llvm/Transforms/Utils/LoopRotationUtils.h"
 #include "llvm/Analysis/InstructionSimplify.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/JSON.h"
 
 
 #include <vector>
+#include <algorithm>
 #include <unordered_map>
+#include <unordered_set>
 #include <set>
+#include <map>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <fstream>
 
 using namespace llvm;
 
+#define DEBUG_TYPE "CAT"
+
+STATISTIC(NumCallsInlined, "Number of calls inlined");
+STATISTIC(NumClones, "Number of callees cloned for a single callsite");
+STATISTIC(NumFunctionsDeleted, "Number of unreachable functions deleted");
+STATISTIC(NumLoopsBatched, "Number of loops rewritten to a CAT array call");
+STATISTIC(NumLoopsUnrolled, "Number of loops unrolled");
+STATISTIC(NumLoopsPeeled, "Number of loops peeled");
+STATISTIC(NumSignaturesPromoted, "Number of functions whose CAT params or return were promoted to int64_t");
+STATISTIC(NumGetsFolded, "Number of CAT_get calls replaced by a constant");
+STATISTIC(NumGetsCopied, "Number of CAT_get calls replaced by an earlier CAT_get");
+STATISTIC(NumOpsFolded, "Number of CAT operations folded to CAT_set");
+STATISTIC(NumImmediateOperands, "Number of CAT_add/CAT_sub rewritten to an immediate operand");
+STATISTIC(NumDeadInstructions, "Number of instructions deleted by DCE");
+STATISTIC(NumBlocksDeleted, "Number of basic blocks deleted or merged into their predecessor");
+STATISTIC(NumAllocationsHoisted, "Number of CAT_new hoisted out of loops");
+STATISTIC(NumConstantsPooled, "Number of CAT_new replaced by a pooled constant object");
+STATISTIC(NumObjectsCoalesced, "Number of CAT_new coalesced into another object");
+STATISTIC(NumFreesInserted, "Number of CAT_free calls inserted");
+STATISTIC(NumCallsLowered, "Number of CAT calls lowered to inline accesses");
+
 namespace {
 
+  enum CATAliasSource { AliasAA, AliasPTA };
+
+  static cl::opt<CATAliasSource> CATAliasSrc("cat-alias",
+      cl::desc("Source of the CAT handle alias sets"),
+      cl::values(
+          clEnumValN(AliasAA, "aa", "Query the AliasAnalysis stack (default)"),
+          clEnumValN(AliasPTA, "pta", "Use the dedicated CAT handle points-to analysis")),
+      cl::init(AliasAA));
+
+  enum CATLowering { LowerNone, LowerChecked, LowerUnchecked };
+
+  static cl::opt<CATLowering> CATLower("cat-lower",
+      cl::desc("Replace the residual CAT calls of an optimized module by inline accesses to the slab objects of CAT_FAST"),
+      cl::values(
+          clEnumValN(LowerNone, "none", "Optimize the CAT calls (default)"),
+          clEnumValN(LowerChecked, "checked", "Inline accesses guarded by the magic word, invalid objects take the runtime call"),
+          clEnumValN(LowerUnchecked, "unchecked", "Inline accesses without validation, as CAT_UNCHECKED")),
+      cl::init(LowerNone));
+
+  static cl::opt<bool> CATUseProfile("cat-use-profile",
+      cl::desc("Let the instrumentation profile attached to the module (clang -fprofile-instr-use) order and size the loop transforms"),
+      cl::init(true));
+
+  static cl::opt<unsigned> CATLoopBudget("cat-loop-budget",
+      cl::desc("With a profile, IR instructions the loop unrolling and peeling may add to the module, hottest loops first"),
+      cl::init(20000));
+
+  static cl::opt<bool> CATEstimateReport("cat-estimate",
+      cl::desc("Print the static estimate of dynamic CAT invocations after every phase of the pass"),
+      cl::init(false));
+
+  static cl::opt<std::string> CATTraceFile("cat-trace",
+      cl::desc("Write a Chrome trace (chrome://tracing) of the CAT phases and per-function transforms to this file"),
+      cl::init(""));
+
+  static cl::list<std::string> CATPTAFuncs("cat-pta-funcs",
+      cl::desc("Functions whose alias sets come from the CAT handle points-to analysis"),
+      cl::CommaSeparated);
+
+
+  enum CATOpKind : uint8_t { NotCATOp = 0, CATNewOp, CATGetOp, CATSetOp, CATAddOp, CATSubOp, CATAddImmOp, CATSubImmOp, CATFreeOp, NumCATOpKinds };
+
+  struct CATOpSemantics {
+    bool isCAT;
+    bool definesResult;     //the call result is a new CAT object
+    int8_t destOperand;     //CAT object redefined by the call, -1 if none
+    int8_t srcOperands[2];  //CAT objects read by the call, -1 if unused
+  };
+
+  static constexpr CATOpSemantics CATOpTable[NumCATOpKinds] = {
+    /* NotCATOp */ {false, false, -1, {-1, -1}},
+    /* CATNewOp */ {true,  true,  -1, {-1, -1}},
+    /* CATGetOp */ {true,  false, -1, { 0, -1}},
+    /* CATSetOp */ {true,  false,  0, {-1, -1}},
+    /* CATAddOp */ {true,  false,  0, { 1,  2}},
+    /* CATSubOp */ {true,  false,  0, { 1,  2}},
+    /* CATAddImmOp */ {true, false, 0, { 1, -1}}, //second operand is an int64_t
+    /* CATSubImmOp */ {true, false, 0, { 1, -1}},
+    /* CATFreeOp */ {true,  false, -1, {-1, -1}}, //ends the object's lifetime, inserted by insertCATFrees
+  };
+
+  inline bool isCATOp(CATOpKind kind){ return CATOpTable[kind].isCAT; }
+  inline bool isCATRedef(CATOpKind kind){ return CATOpTable[kind].destOperand >= 0; } //CAT_set, CAT_add, CAT_sub and their immediate forms
+  inline bool isCATDef(CATOpKind kind){ return CATOpTable[kind].definesResult || isCATRedef(kind); }
+
   struct FunctionSummary {
     std::vector<Instruction*> Insts;
     std::vector<BasicBlock*> CATbbs;
@@ -59,9 +166,125 @@ namespace {
     std::unordered_map<Instruction*,  std::set<Instruction*>> mayMustAliases, mustAliases;
     std::set< CallInst* > nonCATCalls;
     std::vector< StoreInst* > storeInsts;
+    std::unordered_map<Value*, std::vector<StoreInst*>> storesByPointer, storesByValue; //store index, in program order
     std::vector< Instruction* > memInsts;
     std::set< StoreInst* > escapedStores; 
     AliasAnalysis  *aliasAnalysis;    
+    bool analysed = false; //CAT-free functions are never analysed
+  };
+
+
+  enum CATParamEffect : uint8_t { //What a function (callees included) does with a CAT handle parameter
+    ParamRead = 1,     //CAT_get, loads
+    ParamWritten = 2,  //CAT_set/add/sub, stores through it
+    ParamEscapes = 4,  //stored to memory, returned, or handed to code we cannot see
+    ParamPassed = 8    //forwarded to a defined callee, whose effects are merged in
+  };
+
+
+  struct CATTraceEvent { //one phase or per-function region, in microseconds since the pass started
+    std::string name;
+    const char* category;
+    double start = 0;
+    double duration = 0;
+    uint64_t instructionsBefore = 0;
+    uint64_t instructionsAfter = 0;
+  };
+
+  struct CATEstimate { //expected dynamic CAT invocations, see estimateCATInvocations
+    double total = 0; //for one run of the program
+    std::unordered_map<Function*, double> perCall; //for one call of each function, callees included
+  };
+
+  struct FunctionEffects { //Bottom-up side-effect summary of a defined function, callees included
+    bool writesMemory = false;        //stores to globals or to memory reachable from the arguments, calls unknown code
+    bool mayNotReturn = false;        //(mutually) recursive, or calls something that is
+    bool modifiesUnknownCAT = false;  //redefines CAT objects the summary cannot tie to an argument
+    std::set<unsigned> modifiedCATArgs; //redefines CAT objects reachable from these arguments
+    std::vector<uint8_t> paramEffects;  //CATParamEffect bits, one entry per parameter
+
+    bool isPure() const {
+        return !writesMemory && !mayNotReturn && !modifiesUnknownCAT && modifiedCATArgs.empty();
+    }
+
+    bool modifiesCAT() const {
+        return modifiesUnknownCAT || !modifiedCATArgs.empty();
+    }
+
+    bool operator==(const FunctionEffects &other) const {
+        return (writesMemory == other.writesMemory) && (mayNotReturn == other.mayNotReturn)
+            && (modifiesUnknownCAT == other.modifiesUnknownCAT) && (modifiedCATArgs == other.modifiedCATArgs)
+            && (paramEffects == other.paramEffects);
+    }
+
+    bool operator!=(const FunctionEffects &other) const {
+        return !(*this == other);
+    }
+  };
+
+
+  struct CATPointsTo { //Flow-insensitive unification-based (Steensgaard) points-to graph for CAT handles and the slots holding them
+    static const unsigned NONE = ~0u;
+    std::unordered_map<Value*, unsigned> nodeOf;
+    std::vector<unsigned> parent, rank, pointee;
+    unsigned unknown;
+
+    CATPointsTo(){
+        unknown = newNode();
+        pointee[unknown] = unknown; //whatever is loaded through an unknown pointer is unknown too
+    }
+
+    unsigned newNode(){
+        unsigned id = parent.size();
+        parent.push_back(id);
+        rank.push_back(0);
+        pointee.push_back(NONE);
+        return id;
+    }
+
+    unsigned find(unsigned n){
+        while(parent[n] != n){
+            parent[n] = parent[parent[n]]; //path halving
+            n = parent[n];
+        }
+        return n;
+    }
+
+    unsigned getNode(Value* v){ //bitcasts never create a new node
+        v = v->stripPointerCasts();
+        if(isa<ConstantData>(v)) return newNode(); //null, undef and integers never merge unrelated slots
+        auto it = nodeOf.find(v);
+        if(it != nodeOf.end()) return find(it->second);
+        unsigned id = newNode();
+        nodeOf[v] = id;
+        return id;
+    }
+
+    unsigned getPointee(unsigned n){
+        n = find(n);
+        if(pointee[n] == NONE){
+            unsigned id = newNode();
+            pointee[n] = id;
+        }
+        return find(pointee[n]);
+    }
+
+    void unify(unsigned a, unsigned b){
+        std::vector<std::pair<unsigned, unsigned>> worklist;
+        worklist.push_back(std::make_pair(a, b));
+        while(!worklist.empty()){
+            auto p = worklist.back();
+            worklist.pop_back();
+            unsigned x = find(p.first);
+            unsigned y = find(p.second);
+            if(x == y) continue;
+            if(rank[x] < rank[y]) std::swap(x, y);
+            if(rank[x] == rank[y]) rank[x]++;
+            parent[y] = x;
+            if(pointee[x] == NONE) pointee[x] = pointee[y];
+            else if(pointee[y] != NONE) worklist.push_back(std::make_pair(pointee[x], pointee[y]));
+        }
+    }
   };
 
 
@@ -74,10 +297,29 @@ namespace {
     Function* CAT_set;
     Function* CAT_add;
     Function* CAT_sub;
+    Function* CAT_add_imm;
+    Function* CAT_sub_imm;
+    Function* CAT_free;
     Function* CAT_get;
+    Function* CAT_get_array; //batched forms, declared once a loop is rewritten to use them
+    Function* CAT_add_array;
+    Function* CAT_sub_array;
     Function* mainF;
+    ProfileSummaryInfo *PSI;
+    std::unordered_map<BasicBlock*, uint64_t> loopCounts; //profiled header count of the loops of the function being transformed
+    double lastEstimate; //module estimate of the previous phase, for -cat-estimate
+    std::string phaseName;
+    std::vector<CATTraceEvent> traceEvents;
+    std::vector<std::pair<size_t, std::unique_ptr<NamedRegionTimer>>> openRegions; //traceEvents index and timer of the nested regions
+    std::chrono::steady_clock::time_point traceStart;
     std::unordered_map<Function*,FunctionSummary* > summaryNode;
+    std::unordered_map<Function*, CATOpKind> catCallees; //CAT_* declaration -> operation, see classifyCall
     CallGraph *CG;
+    std::unique_ptr<CallGraph> currentCG; //rebuilt once inlining and cloning have rewritten the call sites
+    std::unordered_set<Function*> reachableFuncs; //rooted at main and every externally visible function
+    std::unordered_set<Function*> CATFuncs; //functions that may touch CAT state, directly or through their callees
+    std::unordered_map<Function*, std::vector<CallInst*>> directCATCalls;
+    std::unordered_map<Function*, FunctionEffects> funcEffects; //see computeFunctionEffects
 
 
     // This function is invoked once at the initialization phase of the compiler
@@ -92,12 +334,31 @@ namespace {
         CAT_add = M.getFunction("CAT_add");
         CAT_sub = M.getFunction("CAT_sub");
         CAT_get = M.getFunction("CAT_get");
+        CAT_get_array = M.getFunction("CAT_get_array");
+        CAT_add_array = M.getFunction("CAT_add_array");
+        CAT_sub_array = M.getFunction("CAT_sub_array");
         mainF = M.getFunction("main");
         std::vector<Type*> argTypes;
         argTypes.push_back(PointerType::get(IntegerType::get(M.getContext(), 8), 0));
         argTypes.push_back(IntegerType::get(M.getContext(), 64));
         Constant* set = M.getOrInsertFunction("CAT_set", FunctionType::get(Type::getVoidTy(M.getContext()), argTypes, false ));
         CAT_set = cast<Function>(set); //Create a Func signature for CAT_set since it's used for constant folding and Module may not have it declared
+        std::vector<Type*> immArgTypes;
+        immArgTypes.push_back(PointerType::get(IntegerType::get(M.getContext(), 8), 0));
+        immArgTypes.push_back(PointerType::get(IntegerType::get(M.getContext(), 8), 0));
+        immArgTypes.push_back(IntegerType::get(M.getContext(), 64));
+        Constant* addImm = M.getOrInsertFunction("CAT_add_imm", FunctionType::get(Type::getVoidTy(M.getContext()), immArgTypes, false ));
+        Constant* subImm = M.getOrInsertFunction("CAT_sub_imm", FunctionType::get(Type::getVoidTy(M.getContext()), immArgTypes, false ));
+        CAT_add_imm = cast<Function>(addImm); //targets of the immediate-operand rewrite
+        CAT_sub_imm = cast<Function>(subImm);
+        Constant* catFree = M.getOrInsertFunction("CAT_free", FunctionType::get(Type::getVoidTy(M.getContext()), ArrayRef<Type*>(argTypes[0]), false ));
+        CAT_free = cast<Function>(catFree);
+        catCallees.clear();
+        std::pair<Function*, CATOpKind> catOps[] = {{CAT_new, CATNewOp}, {CAT_get, CATGetOp}, {CAT_set, CATSetOp}, {CAT_add, CATAddOp}, {CAT_sub, CATSubOp},
+                                                     {CAT_add_imm, CATAddImmOp}, {CAT_sub_imm, CATSubImmOp}, {CAT_free, CATFreeOp}};
+        for(auto &op : catOps){
+            if(op.first != NULL) catCallees[op.first] = op.second; //CAT_new, CAT_add, CAT_sub and CAT_get are only known when the program uses them
+        }
         for(auto &F : M){
             summaryNode[&F] = new FunctionSummary();
         }
@@ -108,32 +369,351 @@ namespace {
     bool runOnModule(Module &M) override {
 
         CG = &(getAnalysis<CallGraphWrapperPass>().getCallGraph());
+        PSI = &getAnalysis<ProfileSummaryInfoWrapperPass>().getPSI();
 
         bool modified = false;
+        traceEvents.clear();
+        traceStart = std::chrono::steady_clock::now();
+        lastEstimate = -1;
 
-        findInlinableFuncs(M); //check for direct or indirect function recursions
+        if(CATLower != LowerNone){ //a separate final run: lowered accesses are no longer visible as CAT operations
+            beginPhase(M, "lowering");
+            modified = lowerCATCalls(M);
+            endPhase(M);
+            writeTrace();
+            return modified;
+        }
 
+        reportEstimate(M, "input");
+
+        beginPhase(M, "inlining");
+        computeReachableFuncs(M); //Only functions reachable from main (or from outside the module) are analysed and transformed
+        findInlinableFuncs(M); //check for direct or indirect function recursions
         modified |= inlineFunctions(M); //Inline functions whenever safe
+        endPhase(M);
 
+        beginPhase(M, "cloning");
         modified |= cloneFunctions(M); //Clone the remaining function calls so that each calle has a single callsite to enable input Arg propogation
+        endPhase(M);
 
+        beginPhase(M, "dead functions");
+        refreshCallGraph(M);
+        computeReachableFuncs(M); //inlining and cloning leave originals without callers
+        modified |= removeDeadFunctions(M);
+        buildCATUserIndex(M);
+        endPhase(M);
+
+        beginPhase(M, "loop transforms");
         modified |= transformLoops(M); //Loop unrolling and peeling for functions with < 500 IR instructions
+        buildCATUserIndex(M); //unrolling and peeling duplicated CAT calls
+        endPhase(M);
+
+        beginPhase(M, "function effects");
+        computeFunctionEffects(M); //needed by the GenKill sets and dead-call elimination
+        endPhase(M);
 
+        beginPhase(M, "signature promotion");
+        modified |= promoteCATSignatures(M); //read-only CAT params and fresh CAT returns of internal functions become int64_t
+        endPhase(M);
+
+        beginPhase(M, "summaries");
         getSummary(M);
+        endPhase(M);
 
+        beginPhase(M, "function transforms");
         modified |= transformFunctions(M); //constant folding and constant propogation passes
+        endPhase(M);
+
+        beginPhase(M, "allocation hoisting");
+        modified |= hoistLoopAllocations(M); //per-iteration scratch CAT objects are allocated once and reset with CAT_set
+        endPhase(M);
+
+        beginPhase(M, "constant pooling");
+        modified |= poolConstantCATs(M); //surviving read-only constant CAT objects are created once, before main
+        endPhase(M);
+
+        beginPhase(M, "coalescing");
+        modified |= coalesceCATObjects(M); //CAT objects with disjoint live ranges share one allocation
+        endPhase(M);
 
+        beginPhase(M, "free insertion");
+        modified |= insertCATFrees(M); //non-escaping CAT objects are freed where they die
+        endPhase(M);
+
+        writeTrace();
         return modified;
     }
 
 
+    bool isTimingEnabled(){ //-time-passes reports the phase and per-function timers, -cat-trace records them
+        return TimePassesIsEnabled || !CATTraceFile.empty();
+    }
+
+
+    uint64_t countInstructions(Module &M){
+        uint64_t count = 0;
+        for(auto &F : M){
+            count += F.getInstructionCount();
+        }
+        return count;
+    }
+
+
+    void beginRegion(StringRef name, const char* category, const char* group, const char* groupDesc, uint64_t instructions){
+        CATTraceEvent event;
+        event.name = name.str();
+        event.category = category;
+        event.start = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - traceStart).count();
+        event.instructionsBefore = instructions;
+        traceEvents.push_back(event);
+        openRegions.push_back(std::make_pair(traceEvents.size() - 1, std::unique_ptr<NamedRegionTimer>(
+            new NamedRegionTimer(name, name, group, groupDesc, TimePassesIsEnabled))));
+    }
+
+
+    CATTraceEvent& endRegion(uint64_t instructions){
+        openRegions.back().second.reset(); //stops the timer
+        CATTraceEvent &event = traceEvents[openRegions.back().first];
+        openRegions.pop_back();
+        event.duration = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - traceStart).count() - event.start;
+        event.instructionsAfter = instructions;
+        return event;
+    }
+
+
+    void beginPhase(Module &M, const char* name){
+        phaseName = name;
+        if(!isTimingEnabled()) return;
+        beginRegion(name, "phase", "CAT", "CAT pass phases", countInstructions(M));
+    }
+
+
+    void endPhase(Module &M){
+        if(isTimingEnabled()){
+            CATTraceEvent &event = endRegion(countInstructions(M));
+            errs()<<"\nCAT phase "<<event.name<<": "<<format("%.3f", event.duration / 1000)<<" ms, "
+                <<event.instructionsBefore<<" -> "<<event.instructionsAfter<<" IR instructions";
+        }
+        reportEstimate(M, phaseName.c_str());
+    }
+
+
+    void beginFunction(Function &F){
+        if(!isTimingEnabled()) return;
+        beginRegion(F.getName(), "function", "CAT functions", "CAT per-function transforms", F.getInstructionCount());
+    }
+
+
+    void endFunction(Function &F){
+        if(!isTimingEnabled()) return;
+        endRegion(F.getInstructionCount());
+    }
+
+
+    void writeTrace(){ //Chrome trace event format, complete events on a single thread
+        if(CATTraceFile.empty()) return;
+        json::Array events;
+        for(auto &event : traceEvents){
+            events.push_back(json::Object{
+                {"name", event.name},
+                {"cat", event.category},
+                {"ph", "X"},
+                {"ts", event.start},
+                {"dur", event.duration},
+                {"pid", 1},
+                {"tid", 1},
+                {"args", json::Object{{"instructions_before", (int64_t) event.instructionsBefore}, {"instructions_after", (int64_t) event.instructionsAfter}}}});
+        }
+        std::string trace;
+        raw_string_ostream traceStream(trace);
+        traceStream << json::Value(json::Object{{"traceEvents", std::move(events)}, {"displayTimeUnit", "ms"}});
+        traceStream.flush();
+        std::ofstream out(CATTraceFile);
+        if(!out){
+            errs()<<"\nCannot write the CAT trace to "<<CATTraceFile;
+            return;
+        }
+        out << trace;
+    }
+
+
+    void reportEstimate(Module &M, const char* phase){ //-cat-estimate: predicted invocations left after each phase, and what the phase saved
+        if(!CATEstimateReport) return;
+        CATEstimate estimate = estimateCATInvocations(M);
+        errs()<<"\nCAT estimate after "<<phase<<": "<<format("%.1f", estimate.total)<<" invocations";
+        if(lastEstimate >= 0){
+            double saved = lastEstimate - estimate.total;
+            errs()<<", saved "<<format("%.1f", saved);
+            if(lastEstimate > 0) errs()<<" ("<<format("%.1f", 100.0 * saved / lastEstimate)<<"%)";
+        }
+        lastEstimate = estimate.total;
+    }
+
+
+    CATEstimate estimateCATInvocations(Module &M){ //Expected CAT calls from block frequencies, loop trip counts and the callees' own estimates
+
+        std::unordered_map<Function*, double> local;
+        std::unordered_map<Function*, std::vector<std::pair<Function*, double>>> callees;
+        for(auto &F : M){
+            if(F.isDeclaration()) continue;
+            local[&F] = estimateLocalCATInvocations(F, callees[&F]);
+        }
+
+        CATEstimate estimate;
+        std::unordered_set<Function*> active;
+        std::function<double(Function*)> perCall = [&](Function* F) -> double {
+            auto known = estimate.perCall.find(F);
+            if(known != estimate.perCall.end()) return known->second;
+            if(active.count(F)) return 0; //a recursive call is counted once, at its outermost frame
+            active.insert(F);
+            double total = local[F];
+            for(auto &callee : callees[F]){
+                total += callee.second * perCall(callee.first);
+            }
+            active.erase(F);
+            estimate.perCall[F] = total;
+            return total;
+        };
+
+        if(mainF != NULL && !mainF->isDeclaration()){
+            estimate.total = perCall(mainF);
+        }
+        else{ //a library: every externally visible function is assumed to be called once
+            for(auto &F : M){
+                if(!F.isDeclaration() && !F.hasLocalLinkage()) estimate.total += perCall(&F);
+            }
+        }
+        for(auto &F : M){
+            if(!F.isDeclaration()) perCall(&F);
+        }
+        return estimate;
+    }
+
+
+    double estimateLocalCATInvocations(Function &F, std::vector<std::pair<Function*, double>> &calledFuncs){ //per call of F, callees excluded
+
+        auto &BFI = getAnalysis<BlockFrequencyInfoWrapperPass>(F).getBFI();
+        auto &LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+        auto &SE = getAnalysis<ScalarEvolutionWrapperPass>(F).getSE(); //last: requesting another analysis of F would rebuild it
+        bool profiled = hasProfile() && F.getEntryCount().hasValue(); //measured branch weights beat the static trip counts
+        double entryFreq = (double) BFI.getEntryFreq();
+
+        auto blockFreq = [&](BasicBlock* bb) -> double {
+            double freq = (double) BFI.getBlockFreq(bb).getFrequency() / entryFreq;
+            if(profiled) return freq;
+            for(Loop* loop = LI.getLoopFor(bb); loop != NULL; loop = loop->getParentLoop()){ //replace BFI's guessed loop scale by the known trip count
+                unsigned trips = SE.getSmallConstantTripCount(loop);
+                if((trips == 0) || (loop->getLoopPreheader() == NULL)) continue;
+                double entries = (double) BFI.getBlockFreq(loop->getLoopPreheader()).getFrequency();
+                double iterations = (double) BFI.getBlockFreq(loop->getHeader()).getFrequency();
+                if((entries > 0) && (iterations > 0)) freq *= trips / (iterations / entries);
+            }
+            return freq;
+        };
+
+        double invocations = 0;
+        for(auto &bb : F){
+            double freq = -1;
+            for(auto &i : bb){
+                auto call = dyn_cast<CallInst>(&i);
+                if(call == NULL) continue;
+                Function* calleeF = call->getCalledFunction();
+                if(calleeF == NULL) continue;
+                if(!calleeF->isDeclaration()){
+                    if(freq < 0) freq = blockFreq(&bb);
+                    calledFuncs.push_back(std::make_pair(calleeF, freq));
+                    continue;
+                }
+                if(!calleeF->getName().startswith("CAT_")) continue;
+                if((calleeF == CAT_free) || (calleeF->getName() == "CAT_invocations")) continue; //not counted by the runtime
+                if(freq < 0) freq = blockFreq(&bb);
+                double count = 1;
+                if(isBatchCall(call)){ //one invocation per element, unknown lengths count as one
+                    auto n = dyn_cast<ConstantInt>(call->getArgOperand(call->getNumArgOperands() - 1));
+                    if(n != NULL) count = std::max<int64_t>(0, n->getSExtValue());
+                }
+                invocations += freq * count;
+            }
+        }
+        return invocations;
+    }
+
+
+    void refreshCallGraph(Module &M){
+        currentCG.reset(new CallGraph(M));
+        CG = currentCG.get();
+    }
+
+
+    void computeReachableFuncs(Module &M){
+
+        reachableFuncs.clear();
+        std::vector<CallGraphNode*> worklist;
+        auto markReachable = [&](CallGraphNode* node){
+            Function* F = node->getFunction();
+            if(F == NULL) return;
+            if(reachableFuncs.insert(F).second) worklist.push_back(node);
+        };
+
+        if((mainF != NULL) && !mainF->isDeclaration()){
+            markReachable((*CG)[mainF]);
+            for(auto &F : M){
+                if(F.hasAddressTaken()) markReachable((*CG)[&F]); //may be called indirectly
+                else if(!F.isDeclaration() && !F.hasLocalLinkage()) markReachable((*CG)[&F]); //may be called from another module
+            }
+        }
+        else{
+            for(auto &callRecord : *CG->getExternalCallingNode()){
+                markReachable(callRecord.second);
+            }
+        }
+
+        while(!worklist.empty()){
+            CallGraphNode* node = worklist.back();
+            worklist.pop_back();
+            for(auto &callRecord : *node){
+                markReachable(callRecord.second);
+            }
+        }
+    }
+
+
+    bool removeDeadFunctions(Module &M){ //Delete internal functions left unreachable by inlining and cloning
+
+        std::vector<Function*> deadFuncs;
+        for(auto &F : M){
+            if(F.isDeclaration()) continue;
+            if(reachableFuncs.count(&F)) continue;
+            if(!F.hasLocalLinkage()) continue; //may still be called from another module
+            deadFuncs.push_back(&F);
+        }
+        if(deadFuncs.empty()) return false;
+
+        currentCG.reset(); //the call graph must not outlive the functions it points to
+        CG = NULL;
+        for(auto F : deadFuncs){
+            errs()<<"\nDeleting unreachable function "<<F->getName();
+            F->dropAllReferences(); //dead functions may call each other
+        }
+        for(auto F : deadFuncs){
+            delete summaryNode[F];
+            summaryNode.erase(F);
+            F->eraseFromParent();
+            NumFunctionsDeleted++;
+        }
+        refreshCallGraph(M);
+        return true;
+    }
+
+
     void findInlinableFuncs(Module &M){
 
         for(auto &F : M){
             CallGraphNode *n = (*CG)[&F];
             if(F.isDeclaration()) continue;
             if(F.getNumUses() == 0) continue; //Skip if function is never called
-            if(n->size() > 100) continue; //Ignore functions which have 100+ Calls
+            if(hasProfile() && PSI->isFunctionEntryCold(&F)) continue; //keep cold code out of its callers
+            if((n->size() > 100) && !(hasProfile() && PSI->isFunctionEntryHot(&F))) continue; //Ignore functions which have 100+ Calls, unless they are hot
             if (isRecursiveFunc(&F, &F)) continue;
             F.setDoesNotRecurse();                  
         }
@@ -145,6 +725,7 @@ namespace {
 
         for(auto &F : M){
             if(F.isDeclaration()) continue; //Skip externally declared functions
+            if(!reachableFuncs.count(&F)) continue;
             modified = inlineCallees(F);
         }
         return modified;
@@ -170,6 +751,7 @@ namespace {
                     inlined |= InlineFunction(callInst, IFI);
                     if (inlined) {    
                         errs()<<" -- Succeeded";                
+                        NumCallsInlined++;
                         modified = true;
                         break ;
                     } 
@@ -221,6 +803,7 @@ namespace {
         bool modified = false;
         for(auto &F : M){
             if(F.isDeclaration()) continue; //Skip externally declared functions
+            if(!reachableFuncs.count(&F)) continue;
             modified = cloneCallees(F); //clone all callees until each callee has a single use/callsite
         }
         return modified;
@@ -230,6 +813,7 @@ namespace {
     bool cloneCallees(Function &F) {
 
         bool modified = false;
+        BlockFrequencyInfo* BFI = hasProfile() ? &getAnalysis<BlockFrequencyInfoWrapperPass>(F).getBFI() : NULL;
             
         for (auto &B : F) {
             for (auto &I : B) {
@@ -238,10 +822,14 @@ namespace {
                     if (callInst == nullptr) continue ; //Skip indirect calls
                     if(!calleeF->doesNotRecurse()) continue;
                     if (calleeF->getNumUses()<2) continue; //Skip if If numUses of callee is 1
+                    if ((BFI != NULL) && PSI->isColdBlock(&B, BFI)) continue; //a clone for a cold callsite only grows the module
                     errs() << "Cloning " << calleeF->getName() << " from " << F.getName() << "\n";
                     ValueToValueMapTy VMap;
                     auto clonedCallee = CloneFunction(calleeF, VMap);
+                    clonedCallee->setLinkage(GlobalValue::InternalLinkage); //only ever called from this callsite
+                    reachableFuncs.insert(clonedCallee);
                     callInst->replaceUsesOfWith(calleeF, clonedCallee);
+                    NumClones++;
                     modified = true;    
                 }
             }                  
@@ -251,121 +839,675 @@ namespace {
     }
 
 
-    bool hasCATCalls(Loop *loop){
-        for (auto bbi = loop->block_begin(); bbi != loop->block_end(); ++bbi){
-            BasicBlock *bb = *bbi;
-            for (auto &i : *bb) {
-                if (auto callInst = dyn_cast<CallInst>(&i)){
-                    Function* calleeF = callInst->getCalledFunction();
-                    if((calleeF == CAT_new) ||
-                        (calleeF == CAT_get) ||
-                        (calleeF == CAT_add) ||
-                        (calleeF == CAT_sub) ||
-                        (calleeF == CAT_set)){
-                        return true;
-                    }
-                }
-            }
-        }
-        return false;
-    }
-
-
-    bool transformLoops(Module &M){
+    bool promoteCATSignatures(Module &M){ //Cloning left most internal callees with a single callsite, rewrite them to pass values
 
-        bool modified = false;
-        
+        std::vector<Function*> candidates;
         for(auto &F : M){
-            if(F.isDeclaration()) continue;
-            if((F.getNumUses() == 0) && (&F != mainF)) continue; //Skip if function is never called
-            if(F.getInstructionCount() > 500)  continue;    //don't unroll loops for functions with over 500 IR instructions  
-            auto& LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
-            if(LI.empty()) continue;
-            auto& DT = getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
-            auto& SE = getAnalysis<ScalarEvolutionWrapperPass>(F).getSE();
-            auto &AC = getAnalysis<AssumptionCacheTracker>().getAssumptionCache(F); 
-            auto &TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
-            OptimizationRemarkEmitter ORE(&F);
+            if(F.isDeclaration() || F.isVarArg()) continue;
+            if(!F.hasLocalLinkage() || F.hasAddressTaken()) continue; //every use must be a callsite we can rewrite
+            if((&F == mainF) || !reachableFuncs.count(&F)) continue;
+            candidates.push_back(&F);
+        }
 
-            errs() << "\n TransformLoops pass for Function: " << F.getName() << " with "<<F.getInstructionCount()<<" instructions\n";  
-            std::vector<Loop* > toPeel;
-            for (auto i : LI){
-                auto loop = &*i;
-                if(!hasCATCalls(loop)) continue;   
-                toPeel.push_back(loop);
+        bool modified = false;
+        for(auto F : candidates){
+            std::vector<Value*> freshVals;
+            std::set<unsigned> promotedArgs;
+            for(auto &arg : F->args()){
+                if(isPromotableParam(&arg)) promotedArgs.insert(arg.getArgNo());
             }
-            for (auto i: toPeel){
-                modified |= unrollLoop(LI, i, DT, SE, AC, ORE, TTI);    
-            }        
+            bool promoteReturn = collectFreshReturns(*F, freshVals);
+            if(promotedArgs.empty() && !promoteReturn) continue;
+            if(!modified){
+                currentCG.reset(); //the call graph must not outlive the functions it points to
+                CG = NULL;
+            }
+            promoteSignature(*F, promotedArgs, promoteReturn ? &freshVals : NULL);
+            NumSignaturesPromoted++;
+            modified = true;
+        }
+        if(modified){
+            refreshCallGraph(M);
+            buildCATUserIndex(M);
         }
         return modified;
     }
 
 
-    bool unrollLoop (
-        LoopInfo &LI, 
-        Loop *loop, 
-        DominatorTree &DT, 
-        ScalarEvolution &SE, 
-        AssumptionCache &AC,
-        OptimizationRemarkEmitter &ORE,
-        TargetTransformInfo &TTI
-        ){
+    bool isPromotableParam(Argument* arg){ //Only ever CAT_get, and the object cannot change while the callee runs
+        if(!arg->getType()->isPointerTy() || arg->use_empty()) return false;
+        Function* F = arg->getParent();
+        auto effects = funcEffects.find(F);
+        if((effects == funcEffects.end()) || effects->second.modifiesCAT()) return false;
+        bool readOnEntry = false;
+        for(auto user : arg->users()){
+            auto call = dyn_cast<CallInst>(user);
+            if((call == nullptr) || (getOpKind(call) != CATGetOp)) return false;
+            if(call->getParent() == &F->getEntryBlock()) readOnEntry = true;
+        }
+        return readOnEntry; //otherwise callers could pay for a CAT_get the callee never executes
+    }
 
-        bool modified = false;
 
-        std::vector<Loop *> subLoops = loop->getSubLoops();
-        for (auto j : subLoops){
-            auto subloop = &*j;
-            if(subloop->getLoopDepth() >3) continue;
-            if (unrollLoop(LI, subloop, DT, SE, AC, ORE, TTI)){
-                return true;
-            }       
+    bool collectFreshReturns(Function &F, std::vector<Value*> &freshVals){ //Every returned handle is a CAT_new of F that is only read before returning
+        if(!F.getReturnType()->isPointerTy()) return false;
+        std::vector<Value*> worklist;
+        std::unordered_set<Value*> fresh;
+        for(auto &bb : F){
+            if(auto ret = dyn_cast<ReturnInst>(bb.getTerminator())) worklist.push_back(ret->getReturnValue());
+        }
+        if(worklist.empty()) return false;
+        while(!worklist.empty()){
+            Value* v = worklist.back();
+            worklist.pop_back();
+            if(!fresh.insert(v).second) continue;
+            freshVals.push_back(v);
+            if(auto phi = dyn_cast<PHINode>(v)){
+                for(auto &incoming : phi->incoming_values()) worklist.push_back(incoming);
+            }
+            else if(getOpKind(v) != CATNewOp){
+                return false;
+            }
         }
-        
-        if(loop->getLoopDepth() >3) //skip nested loops with depth >3
-            return false;
-
-        errs()<<"\n\nTrying to unroll/peel ";
-        loop->print(errs());
-       
-        if (!(loop->isLoopSimplifyForm()  && loop->isLCSSAForm(DT))){
-            errs()<<"\nloop not normalized"; 
-            return false; 
+        for(auto v : freshVals){
+            for(auto user : v->users()){
+                if(isa<ReturnInst>(user) || fresh.count(user)) continue;
+                if(auto call = dyn_cast<CallInst>(user)){
+                    if(getOpKind(call) == CATGetOp) continue;
+                }
+                return false;
+            }
         }
-           
-        errs()<<"\n\nTrying to unroll loop";
-        auto tripCount = SE.getSmallConstantTripCount(loop);
-        auto tripMultiple = SE.getSmallConstantTripMultiple(loop);
-        auto forceUnroll = false;
-        auto allowRuntime = true;
-        auto allowExpensiveTripCount = true;
-        auto preserveCondBr = false;
-        auto preserveOnlyFirst = false;
-        auto peelingCount = 1;
-        auto unrollFactor = 2;
-        LoopUnrollResult unrolled;
-
+        return true;
+    }
 
-        if(tripMultiple > 1){
-            if ((tripCount >0) && (tripCount<20)){
-                unrollFactor = tripCount;
-                peelingCount = 0;
-            }
-              errs() << "\n   Trip count: " << tripCount << "\n";
-              errs() << "\n   Trip multiple: " << tripMultiple << "\n";
-            unrolled = UnrollLoop(
-                loop, unrollFactor, 
-                tripCount, 
-                forceUnroll, allowRuntime, allowExpensiveTripCount, preserveCondBr, preserveOnlyFirst, 
-                tripMultiple, peelingCount, 
-                false, 
-                &LI, &SE, &DT, &AC, &ORE,
-                true);
 
-            if (unrolled != LoopUnrollResult::Unmodified ){
-                errs()<<"\nloop unrolling-- success";
-                return true;
+    void promoteSignature(Function &F, const std::set<unsigned> &promotedArgs, std::vector<Value*>* freshVals){
+        errs() << "Promoting CAT handles of " << F.getName() << "\n";
+        LLVMContext &ctx = F.getContext();
+        Type* valueTy = IntegerType::get(ctx, 64);
+
+        std::vector<Type*> paramTypes;
+        for(auto &arg : F.args()){
+            paramTypes.push_back(promotedArgs.count(arg.getArgNo()) ? valueTy : arg.getType());
+        }
+        Type* retTy = (freshVals != NULL) ? valueTy : F.getReturnType();
+        Function* NF = Function::Create(FunctionType::get(retTy, paramTypes, false), F.getLinkage(), "", F.getParent());
+        NF->copyAttributesFrom(&F);
+        for(auto argNo : promotedArgs){
+            NF->removeParamAttrs(argNo, AttributeFuncs::typeIncompatible(valueTy));
+        }
+        if(freshVals != NULL) NF->removeAttributes(AttributeList::ReturnIndex, AttributeFuncs::typeIncompatible(valueTy));
+        NF->getBasicBlockList().splice(NF->begin(), F.getBasicBlockList());
+        NF->takeName(&F);
+
+        auto newArg = NF->arg_begin();
+        for(auto &arg : F.args()){
+            if(promotedArgs.count(arg.getArgNo())){
+                std::vector<Instruction*> gets;
+                for(auto user : arg.users()) gets.push_back(cast<Instruction>(user));
+                for(auto get : gets){
+                    get->replaceAllUsesWith(&*newArg);
+                    get->eraseFromParent();
+                }
+            }
+            else{
+                arg.replaceAllUsesWith(&*newArg);
+            }
+            newArg->takeName(&arg);
+            ++newArg;
+        }
+        if(freshVals != NULL) lowerFreshReturns(*NF, *freshVals, valueTy);
+
+        std::vector<CallInst*> calls;
+        for(auto user : F.users()) calls.push_back(cast<CallInst>(user));
+        for(auto call : calls){
+            IRBuilder<> builder(call);
+            std::vector<Value*> args;
+            for(unsigned argNo = 0; argNo < call->getNumArgOperands(); argNo++){
+                Value* arg = call->getArgOperand(argNo);
+                if(promotedArgs.count(argNo)){
+                    CallInst* get = builder.CreateCall(CAT_get, ArrayRef<Value*>(arg));
+                    arg = get;
+                }
+                args.push_back(arg);
+            }
+            CallInst* newCall = builder.CreateCall(NF, ArrayRef<Value*>(args));
+            newCall->setCallingConv(call->getCallingConv());
+            newCall->setDebugLoc(call->getDebugLoc());
+            if(freshVals != NULL){ //the value replaces the caller's reads, a handle is only built when something else needs it
+                std::vector<Instruction*> gets;
+                bool needsHandle = false;
+                bool foldGets = true;
+                for(auto &U : call->uses()){
+                    auto user = dyn_cast<CallInst>(U.getUser());
+                    CATOpKind useKind = (user != nullptr) ? getOpKind(user) : NotCATOp;
+                    if(useKind == CATGetOp){
+                        gets.push_back(user);
+                        continue;
+                    }
+                    needsHandle = true;
+                    if(!isCATOp(useKind)) foldGets = false; //the handle escapes, the object may be redefined through an alias
+                    else if(isCATRedef(useKind) && ((int)U.getOperandNo() == CATOpTable[useKind].destOperand)) foldGets = false; //the reads may follow a redefinition
+                }
+                if(!foldGets) gets.clear(); //the reads stay on the handle built below
+                for(auto get : gets){
+                    get->replaceAllUsesWith(newCall);
+                    get->eraseFromParent();
+                }
+                if(needsHandle){
+                    CallInst* handle = builder.CreateCall(CAT_new, ArrayRef<Value*>(newCall));
+                    call->replaceAllUsesWith(handle);
+                }
+            }
+            else{
+                call->replaceAllUsesWith(newCall);
+            }
+            newCall->takeName(call);
+            call->eraseFromParent();
+        }
+
+        FunctionEffects effects = funcEffects[&F];
+        for(auto argNo : promotedArgs) effects.paramEffects[argNo] = 0;
+        funcEffects.erase(&F);
+        funcEffects[NF] = effects;
+        summaryNode[NF] = summaryNode[&F];
+        summaryNode.erase(&F);
+        reachableFuncs.erase(&F);
+        reachableFuncs.insert(NF);
+        F.eraseFromParent();
+    }
+
+
+    void lowerFreshReturns(Function &F, std::vector<Value*> &freshVals, Type* valueTy){ //Returned CAT_news and the phis joining them become their int64_t values
+        std::unordered_map<Value*, Value*> valueOf;
+        std::vector<PHINode*> phis;
+        for(auto v : freshVals){
+            if(auto phi = dyn_cast<PHINode>(v)){
+                valueOf[phi] = PHINode::Create(valueTy, phi->getNumIncomingValues(), phi->getName() + ".val", phi);
+                phis.push_back(phi);
+            }
+            else{
+                valueOf[v] = cast<CallInst>(v)->getArgOperand(0);
+            }
+        }
+        for(auto phi : phis){
+            auto valuePhi = cast<PHINode>(valueOf[phi]);
+            for(unsigned i = 0; i < phi->getNumIncomingValues(); i++){
+                valuePhi->addIncoming(valueOf[phi->getIncomingValue(i)], phi->getIncomingBlock(i));
+            }
+        }
+        for(auto &bb : F){
+            auto ret = dyn_cast<ReturnInst>(bb.getTerminator());
+            if(ret == nullptr) continue;
+            ReturnInst::Create(F.getContext(), valueOf[ret->getReturnValue()], ret);
+            ret->eraseFromParent();
+        }
+        for(auto v : freshVals){
+            std::vector<Instruction*> gets;
+            for(auto user : v->users()){
+                if(!isa<PHINode>(user)) gets.push_back(cast<Instruction>(user));
+            }
+            for(auto get : gets){
+                get->replaceAllUsesWith(valueOf[v]);
+                get->eraseFromParent();
+            }
+        }
+        for(auto phi : phis) phi->dropAllReferences();
+        for(auto phi : phis) phi->eraseFromParent();
+        for(auto v : freshVals){
+            if(isa<PHINode>(v)) continue;
+            cast<Instruction>(v)->eraseFromParent();
+        }
+    }
+
+
+    CATOpKind classifyCall(CallInst* call){
+        Function* calleeF = call->getCalledFunction();
+        if(calleeF == NULL) return NotCATOp;
+        auto it = catCallees.find(calleeF);
+        if(it == catCallees.end()) return NotCATOp;
+        return it->second;
+    }
+
+
+    CATOpKind getOpKind(Value* v){
+        auto call = dyn_cast<CallInst>(v);
+        if(call == nullptr) return NotCATOp;
+        return classifyCall(call);
+    }
+
+
+    void buildCATUserIndex(Module &M){ //CAT-touching functions from the CAT_* use lists and their transitive callers
+
+        CATFuncs.clear();
+        directCATCalls.clear();
+
+        std::unordered_map<CallGraphNode*, std::vector<CallGraphNode*>> callers;
+        for(auto &node : *CG){
+            for(auto &callRecord : *node.second){
+                callers[callRecord.second].push_back(node.second.get());
+            }
+        }
+
+        std::vector<CallGraphNode*> worklist;
+        bool indirectCAT = false;
+        auto markCATFunc = [&](Function* F){
+            if(!CATFuncs.insert(F).second) return;
+            worklist.push_back((*CG)[F]);
+            if(F->hasAddressTaken()) indirectCAT = true;
+        };
+        Function* CATDecls[] = {CAT_new, CAT_get, CAT_set, CAT_add, CAT_sub, CAT_add_imm, CAT_sub_imm, CAT_free};
+        for(auto catF : CATDecls){
+            if(catF == NULL) continue;
+            for(auto user : catF->users()){
+                auto call = dyn_cast<CallInst>(user);
+                if((call == nullptr) || (call->getCalledFunction() != catF)){
+                    indirectCAT = true;
+                    continue;
+                }
+                directCATCalls[call->getFunction()].push_back(call);
+                markCATFunc(call->getFunction());
+            }
+        }
+
+        bool externalQueued = false;
+        while(true){
+            if(indirectCAT && !externalQueued){ //any unknown callee may reach CAT state through a function pointer
+                worklist.push_back(CG->getCallsExternalNode());
+                externalQueued = true;
+            }
+            if(worklist.empty()) break;
+            CallGraphNode* node = worklist.back();
+            worklist.pop_back();
+            for(auto caller : callers[node]){
+                if(caller->getFunction() == NULL) continue;
+                markCATFunc(caller->getFunction());
+            }
+        }
+        errs()<<"\nCAT user index: "<<CATFuncs.size()<<" CAT functions, "<<directCATCalls.size()<<" with direct CAT calls";
+    }
+
+
+    bool hasCATCalls(Loop *loop){
+        auto calls = directCATCalls.find(loop->getHeader()->getParent());
+        if(calls == directCATCalls.end()) return false;
+        for(auto call : calls->second){
+            if(loop->contains(call)) return true;
+        }
+        return false;
+    }
+
+
+    bool hasProfile(){
+        return CATUseProfile && (PSI != NULL) && PSI->hasProfileSummary();
+    }
+
+
+    uint64_t getCATLoopWeight(Loop* loop){ //profiled CAT calls issued from the loop: header count times CAT callsites
+        auto count = loopCounts.find(loop->getHeader());
+        if(count == loopCounts.end()) return 0;
+        uint64_t calls = 0;
+        for(auto call : directCATCalls[loop->getHeader()->getParent()]){
+            if(loop->contains(call)) calls++;
+        }
+        return count->second * calls;
+    }
+
+
+    bool isColdLoop(Loop* loop){
+        if(!hasProfile()) return false;
+        auto count = loopCounts.find(loop->getHeader());
+        return (count != loopCounts.end()) && PSI->isColdCount(count->second);
+    }
+
+
+    void recordLoopCounts(Function &F){ //snapshot taken before unrolling, BFI is stale afterwards
+        loopCounts.clear();
+        if(!hasProfile()) return;
+        auto &BFI = getAnalysis<BlockFrequencyInfoWrapperPass>(F).getBFI();
+        auto &LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+        for(auto loop : LI.getLoopsInPreorder()){
+            auto count = BFI.getBlockProfileCount(loop->getHeader());
+            if(count.hasValue()) loopCounts[loop->getHeader()] = count.getValue();
+            if(loop->getLoopPreheader() == NULL) continue;
+            auto entries = BFI.getBlockProfileCount(loop->getLoopPreheader());
+            if(entries.hasValue()) loopCounts[loop->getLoopPreheader()] = entries.getValue();
+        }
+    }
+
+
+    unsigned getPeelCount(Loop* loop){ //10 iterations, or the average trip count of the profile when lower
+        unsigned peelingCount = 10;
+        if(!hasProfile() || (loop->getLoopPreheader() == NULL)) return peelingCount;
+        auto iterations = loopCounts.find(loop->getHeader());
+        auto entries = loopCounts.find(loop->getLoopPreheader());
+        if((iterations == loopCounts.end()) || (entries == loopCounts.end()) || (entries->second == 0)) return peelingCount;
+        uint64_t averageTrips = iterations->second / entries->second;
+        return (unsigned) std::max<uint64_t>(1, std::min<uint64_t>(peelingCount, averageTrips));
+    }
+
+
+    bool transformLoops(Module &M){
+
+        bool modified = false;
+
+        std::vector<std::pair<uint64_t, Function*>> order; //with a profile, functions with the hottest CAT loops come first
+        for(auto &F : M){
+            if(F.isDeclaration()) continue;
+            if(!reachableFuncs.count(&F)) continue; //Skip if function is never called
+            if(directCATCalls.find(&F) == directCATCalls.end()) continue; //no loop of F calls the CAT API
+            uint64_t weight = 0;
+            if(hasProfile()){
+                recordLoopCounts(F);
+                auto& LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+                for(auto loop : LI){
+                    weight = std::max(weight, getCATLoopWeight(loop));
+                }
+            }
+            order.push_back(std::make_pair(weight, &F));
+        }
+        if(hasProfile()){
+            std::stable_sort(order.begin(), order.end(), [](const std::pair<uint64_t, Function*> &a, const std::pair<uint64_t, Function*> &b){
+                return a.first > b.first;
+            });
+        }
+
+        int64_t budget = CATLoopBudget;
+        for(auto &weighted : order){
+            Function &F = *weighted.second;
+            unsigned sizeLimit = (hasProfile() && PSI->isFunctionEntryHot(&F)) ? 2000 : 500;
+            if(F.getInstructionCount() > sizeLimit)  continue;    //don't unroll loops for functions with over 500 IR instructions (2000 when hot)
+            if(hasProfile() && (budget <= 0)) break; //the remaining loops are colder than those already grown
+            recordLoopCounts(F); //first: requesting BFI reruns the function analyses taken below
+            auto& LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+            if(LI.empty()) continue;
+            auto& DT = getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+            auto& SE = getAnalysis<ScalarEvolutionWrapperPass>(F).getSE();
+            auto &AC = getAnalysis<AssumptionCacheTracker>().getAssumptionCache(F); 
+            auto &TTI = getAnalysis<TargetTransformInfoWrapperPass>().getTTI(F);
+            OptimizationRemarkEmitter ORE(&F);
+
+            errs() << "\n TransformLoops pass for Function: " << F.getName() << " with "<<F.getInstructionCount()<<" instructions\n";  
+            std::vector<Loop* > toPeel;
+            for (auto loop : LI.getLoopsInPreorder()){
+                if(!loop->getSubLoops().empty()) continue;
+                if(!hasCATCalls(loop)) continue;
+                modified |= batchLoop(loop, DT); //an element-wise loop becomes one array call, nothing is left to unroll
+            }
+            for (auto i : LI){
+                auto loop = &*i;
+                if(!hasCATCalls(loop)) continue;   
+                if(isColdLoop(loop)) continue; //never or rarely run in the training run
+                toPeel.push_back(loop);
+            }
+            if(hasProfile()){
+                std::stable_sort(toPeel.begin(), toPeel.end(), [this](Loop* a, Loop* b){
+                    return getCATLoopWeight(a) > getCATLoopWeight(b);
+                });
+            }
+            beginFunction(F);
+            for (auto i: toPeel){
+                if(hasProfile() && (budget <= 0)) break;
+                int64_t sizeBefore = F.getInstructionCount();
+                modified |= unrollLoop(LI, i, DT, SE, AC, ORE, TTI);    
+                budget -= (int64_t) F.getInstructionCount() - sizeBefore;
+            }        
+            endFunction(F);
+        }
+        return modified;
+    }
+
+
+    Function* getBatchFunction(CATOpKind kind){
+        LLVMContext &C = currM->getContext();
+        Type* handleTy = PointerType::get(IntegerType::get(C, 8), 0);
+        Type* arrayTy = PointerType::get(handleTy, 0);
+        Type* int64Ty = IntegerType::get(C, 64);
+        std::vector<Type*> argTypes;
+        if(kind == CATGetOp){
+            if(CAT_get_array == NULL){
+                argTypes = {PointerType::get(int64Ty, 0), arrayTy, int64Ty};
+                Constant* getArray = currM->getOrInsertFunction("CAT_get_array", FunctionType::get(Type::getVoidTy(C), argTypes, false));
+                CAT_get_array = cast<Function>(getArray);
+            }
+            return CAT_get_array;
+        }
+        argTypes = {arrayTy, arrayTy, arrayTy, int64Ty};
+        if((kind == CATAddOp) && (CAT_add_array == NULL)){
+            Constant* addArray = currM->getOrInsertFunction("CAT_add_array", FunctionType::get(Type::getVoidTy(C), argTypes, false));
+            CAT_add_array = cast<Function>(addArray);
+        }
+        if((kind == CATSubOp) && (CAT_sub_array == NULL)){
+            Constant* subArray = currM->getOrInsertFunction("CAT_sub_array", FunctionType::get(Type::getVoidTy(C), argTypes, false));
+            CAT_sub_array = cast<Function>(subArray);
+        }
+        return (kind == CATAddOp) ? CAT_add_array : CAT_sub_array;
+    }
+
+
+    bool isBatchCall(CallInst* call){
+        Function* calleeF = call->getCalledFunction();
+        if(calleeF == NULL) return false;
+        return (calleeF == CAT_get_array) || (calleeF == CAT_add_array) || (calleeF == CAT_sub_array);
+    }
+
+
+    Value* getIndexedArray(Value* ptr, Value* iv, Loop* loop, IRBuilder<>* builder){ //&base[iv] with a loop-invariant base, emits the address of base[0] unless builder is NULL
+        auto gep = dyn_cast<GetElementPtrInst>(ptr);
+        if(gep == NULL) return NULL;
+        if(!loop->isLoopInvariant(gep->getPointerOperand())) return NULL;
+        Value* index = NULL;
+        if(gep->getNumIndices() == 1){
+            index = gep->getOperand(1);
+        }
+        else if(gep->getNumIndices() == 2){ //&array[0][iv]
+            auto first = dyn_cast<ConstantInt>(gep->getOperand(1));
+            if((first == NULL) || !first->isZero()) return NULL;
+            index = gep->getOperand(2);
+        }
+        else return NULL;
+        if(isa<SExtInst>(index) || isa<ZExtInst>(index)) index = cast<CastInst>(index)->getOperand(0);
+        if(index != iv) return NULL;
+        if((gep->getNumIndices() == 1) || (builder == NULL)) return gep->getPointerOperand();
+        Value* zero = ConstantInt::get(gep->getOperand(1)->getType(), 0);
+        Value* indices[] = {zero, zero};
+        return builder->CreateInBoundsGEP(gep->getSourceElementType(), gep->getPointerOperand(), indices);
+    }
+
+
+    Value* getBatchTripCount(Loop* loop, PHINode* iv, IRBuilder<>* builder){ //iterations of a loop exiting on iv < n or iv.next < n, the bound itself unless builder is set
+        BasicBlock* exiting = loop->getExitingBlock();
+        auto br = dyn_cast<BranchInst>(exiting->getTerminator());
+        if((br == NULL) || br->isUnconditional()) return NULL;
+        auto cmp = dyn_cast<ICmpInst>(br->getCondition());
+        if(cmp == NULL) return NULL;
+        ICmpInst::Predicate pred = cmp->getPredicate();
+        if(!loop->contains(br->getSuccessor(0))) pred = ICmpInst::getInversePredicate(pred); //pred now holds while the loop continues
+        Value* counter = cmp->getOperand(0);
+        Value* bound = cmp->getOperand(1);
+        if(loop->isLoopInvariant(counter)){
+            std::swap(counter, bound);
+            pred = ICmpInst::getSwappedPredicate(pred);
+        }
+        if(!loop->isLoopInvariant(bound)) return NULL;
+        if((pred != ICmpInst::ICMP_SLT) && (pred != ICmpInst::ICMP_ULT) && (pred != ICmpInst::ICMP_NE)) return NULL;
+        bool latchForm;
+        bool testsOldIV = false;
+        if(counter == iv){
+            if(exiting != loop->getHeader()) return NULL;
+            latchForm = testsOldIV = (exiting == loop->getLoopLatch()); //do { ... } while(i++ < n): a single block tested after the body
+        }
+        else if(counter == iv->getIncomingValueForBlock(loop->getLoopLatch())){
+            if(exiting != loop->getLoopLatch()) return NULL;
+            latchForm = true;
+        }
+        else return NULL;
+        if(builder == NULL) return bound;
+        Type* int64Ty = IntegerType::get(currM->getContext(), 64);
+        Value* n = (pred == ICmpInst::ICMP_ULT) ? builder->CreateZExtOrTrunc(bound, int64Ty) : builder->CreateSExtOrTrunc(bound, int64Ty);
+        if(testsOldIV) n = builder->CreateAdd(n, ConstantInt::get(int64Ty, 1)); //the body also runs for iv == n
+        if(latchForm){ //the body runs once before the first test
+            Value* one = ConstantInt::get(int64Ty, 1);
+            n = builder->CreateSelect(builder->CreateICmpSLT(n, one), one, n);
+        }
+        return n;
+    }
+
+
+    bool batchLoop(Loop* loop, DominatorTree &DT){ //for(i = 0; i < n; i++) CAT_add(r[i], a[i], b[i]) becomes CAT_add_array(r, a, b, n)
+
+        BasicBlock* preheader = loop->getLoopPreheader();
+        BasicBlock* latch = loop->getLoopLatch();
+        if((preheader == NULL) || (latch == NULL) || (loop->getExitingBlock() == NULL)) return false;
+        PHINode* iv = loop->getCanonicalInductionVariable();
+        if(iv == NULL) return false;
+
+        CallInst* catCall = NULL;
+        StoreInst* getStore = NULL;
+        for(auto bb : loop->getBlocks()){
+            for(auto &i : *bb){
+                if(auto call = dyn_cast<CallInst>(&i)){
+                    if(isa<DbgInfoIntrinsic>(call)) continue;
+                    if(catCall != NULL) return false;
+                    catCall = call;
+                }
+                else if(auto store = dyn_cast<StoreInst>(&i)){
+                    if(getStore != NULL) return false;
+                    getStore = store;
+                }
+                else if(!isa<LoadInst>(&i) && i.mayHaveSideEffects()) return false;
+                else if(auto load = dyn_cast<LoadInst>(&i)){
+                    if(!load->isSimple()) return false;
+                }
+            }
+        }
+        if(catCall == NULL) return false;
+        CATOpKind kind = getOpKind(catCall);
+        if((kind != CATAddOp) && (kind != CATSubOp) && (kind != CATGetOp)) return false;
+        if(!DT.dominates(catCall->getParent(), latch)) return false;
+        if((catCall->getParent() == loop->getExitingBlock()) && (loop->getExitingBlock() != latch)) return false; //would run once more than the body
+
+        Type* handleTy = PointerType::get(IntegerType::get(currM->getContext(), 8), 0);
+        std::vector<Value*> elementPtrs;
+        if(kind == CATGetOp){
+            if((getStore == NULL) || !catCall->hasOneUse() || (catCall->user_back() != getStore)) return false;
+            if(getStore->getValueOperand() != catCall || !getStore->isSimple()) return false;
+            elementPtrs.push_back(getStore->getPointerOperand());
+        }
+        else if(getStore != NULL) return false;
+        for(unsigned argNo = 0; argNo < catCall->getNumArgOperands(); argNo++){
+            auto load = dyn_cast<LoadInst>(catCall->getArgOperand(argNo)->stripPointerCasts());
+            if((load == NULL) || !load->hasOneUse() || !loop->contains(load)) return false;
+            if(load->getType() != handleTy) return false;
+            elementPtrs.push_back(load->getPointerOperand());
+        }
+
+        for(auto ptr : elementPtrs){
+            if(getIndexedArray(ptr, iv, loop, NULL) == NULL) return false;
+        }
+        if(getBatchTripCount(loop, iv, NULL) == NULL) return false;
+
+        IRBuilder<> builder(preheader->getTerminator());
+        std::vector<Value*> args;
+        for(auto ptr : elementPtrs){
+            args.push_back(getIndexedArray(ptr, iv, loop, &builder));
+        }
+        Value* n = getBatchTripCount(loop, iv, &builder);
+        Function* batchF = getBatchFunction(kind);
+        FunctionType* batchTy = batchF->getFunctionType();
+        args.push_back(n);
+        for(unsigned argNo = 0; argNo < args.size(); argNo++){
+            args[argNo] = builder.CreatePointerBitCastOrAddrSpaceCast(args[argNo], batchTy->getParamType(argNo));
+        }
+        builder.CreateCall(batchF, ArrayRef<Value *>(args));
+        NumLoopsBatched++;
+        errs()<<"\nBatched loop into "<<batchF->getName()<<": ";
+        catCall->print(errs());
+
+        Function* F = preheader->getParent();
+        auto &calls = directCATCalls[F];
+        calls.erase(std::remove(calls.begin(), calls.end(), catCall), calls.end());
+        std::vector<Value*> operands(catCall->arg_begin(), catCall->arg_end());
+        if(getStore != NULL){
+            operands.push_back(getStore->getPointerOperand());
+            getStore->eraseFromParent();
+        }
+        catCall->eraseFromParent();
+        for(auto op : operands){
+            RecursivelyDeleteTriviallyDeadInstructions(op); //the element loads and addresses, the empty loop itself is left to later cleanup
+        }
+        return true;
+    }
+
+
+    bool unrollLoop (
+        LoopInfo &LI, 
+        Loop *loop, 
+        DominatorTree &DT, 
+        ScalarEvolution &SE, 
+        AssumptionCache &AC,
+        OptimizationRemarkEmitter &ORE,
+        TargetTransformInfo &TTI
+        ){
+
+        bool modified = false;
+
+        std::vector<Loop *> subLoops = loop->getSubLoops();
+        for (auto j : subLoops){
+            auto subloop = &*j;
+            if(subloop->getLoopDepth() >3) continue;
+            if(isColdLoop(subloop)) continue;
+            if (unrollLoop(LI, subloop, DT, SE, AC, ORE, TTI)){
+                return true;
+            }       
+        }
+        
+        if(loop->getLoopDepth() >3) //skip nested loops with depth >3
+            return false;
+
+        errs()<<"\n\nTrying to unroll/peel ";
+        loop->print(errs());
+       
+        if (!(loop->isLoopSimplifyForm()  && loop->isLCSSAForm(DT))){
+            errs()<<"\nloop not normalized"; 
+            return false; 
+        }
+           
+        errs()<<"\n\nTrying to unroll loop";
+        auto tripCount = SE.getSmallConstantTripCount(loop);
+        auto tripMultiple = SE.getSmallConstantTripMultiple(loop);
+        auto forceUnroll = false;
+        auto allowRuntime = true;
+        auto allowExpensiveTripCount = true;
+        auto preserveCondBr = false;
+        auto preserveOnlyFirst = false;
+        auto peelingCount = 1;
+        auto unrollFactor = 2;
+        LoopUnrollResult unrolled;
+
+
+        unsigned fullUnrollLimit = (hasProfile() && !isColdLoop(loop) && (getCATLoopWeight(loop) > 0) && PSI->isHotCount(loopCounts[loop->getHeader()])) ? 64 : 20; //hot loops may be unrolled further
+        if(tripMultiple > 1){
+            if ((tripCount >0) && (tripCount<fullUnrollLimit)){
+                unrollFactor = tripCount;
+                peelingCount = 0;
+            }
+              errs() << "\n   Trip count: " << tripCount << "\n";
+              errs() << "\n   Trip multiple: " << tripMultiple << "\n";
+            unrolled = UnrollLoop(
+                loop, unrollFactor, 
+                tripCount, 
+                forceUnroll, allowRuntime, allowExpensiveTripCount, preserveCondBr, preserveOnlyFirst, 
+                tripMultiple, peelingCount, 
+                false, 
+                &LI, &SE, &DT, &AC, &ORE,
+                true);
+
+            if (unrolled != LoopUnrollResult::Unmodified ){
+                errs()<<"\nloop unrolling-- success";
+                NumLoopsUnrolled++;
+                return true;
             }
             else{
                 errs()<<"\nloop unrolling -- failed";
@@ -388,10 +1530,11 @@ namespace {
             }
         }
         if(!canPeel(loop)) return false;
-        peelingCount = 10;
+        peelingCount = getPeelCount(loop);
         errs() << "\n   PeelingCount: " << peelingCount << "\n";
         if(peelLoop( loop, peelingCount, &LI, &SE, &DT, &AC, true)){
             errs() << "loop peeling-- success\n";
+            NumLoopsPeeled++;
             return true ;
         }
         else{
@@ -438,6 +1581,7 @@ namespace {
         auto peelingCount = 1;
         if(peelLoop( loop, peelingCount, &LI, &SE, &DT, &AC, true)){
             errs() << "loop peeling-- success\n";
+            NumLoopsPeeled++;
             return true ;
         }
         else{
@@ -453,7 +1597,8 @@ namespace {
 
         for (auto &F : M){
             if(F.isDeclaration()) continue; //Skip externally declared functions  
-            if((F.getNumUses() == 0) && (&F != mainF)) continue; //Skip if function is never called         
+            if(!reachableFuncs.count(&F)) continue; //Skip if function is never called         
+            if(!CATFuncs.count(&F)) continue; //Skip functions that cannot touch CAT state
             CATFuncAnalyse(F); //Initializes sets and computes aliases and reaching defs       
         } 
 
@@ -461,7 +1606,8 @@ namespace {
         while(i++<2){
             for (auto &F : M){
                 if(F.isDeclaration()) continue; //Skip externally declared functions  
-                if((F.getNumUses() == 0) && (&F != mainF)) continue; //Skip if function is never called      
+                if(!reachableFuncs.count(&F)) continue; //Skip if function is never called      
+                if(!CATFuncs.count(&F)) continue;
                 getRetConstant(F); //If a function returns a constant value, add it to summaryNode funcReturnVals[F] to enable retVal propogation at callsite;    
                 getCalleeArgConstants(F);  
 
@@ -497,6 +1643,7 @@ namespace {
             if(calleeF->isDeclaration()) continue; //Skip externally declared functions  
             if(calleeF->getNumUses()>1) continue; //Skip if If numUses of callee is more than 1    
             if(calleeF == &F) continue; //Skip recursive functions
+            if(!CATFuncs.count(calleeF)) continue; //never analysed or transformed, a clone of it may not even have a summary
             for (int i = 0; i < call->getNumArgOperands(); i++) {
                 errs()<<"\nChecking for a constant for input argument \""<<i<<"\" of callee: "<<call->getCalledFunction()->getName();
                 auto* arg = call->getArgOperand(i);
@@ -508,12 +1655,10 @@ namespace {
                 else{
                     Value *constant_to_propogate = NULL;   
                     bool escapedstore = false;            
-                    for(auto store : summaryNode[&F]->storeInsts){
-                        if(arg == store->getPointerOperand()){
-                            escapedstore = true;
-                            constant_to_propogate = getConstant(store, 0, true);
-                            break;
-                        }
+                    auto storesToArg = summaryNode[&F]->storesByPointer.find(arg);
+                    if(storesToArg != summaryNode[&F]->storesByPointer.end()){
+                        escapedstore = true;
+                        constant_to_propogate = getConstant(storesToArg->second.front(), 0, true);
                     }
                     if(!escapedstore){
                         if(auto *defInst = dyn_cast<Instruction>(arg)){
@@ -538,10 +1683,13 @@ namespace {
         bool modified = false;
         for (auto &F : M){
             if(F.isDeclaration()) continue; //Skip externally declared functions 
-            if((F.getNumUses() == 0) && (&F != mainF)) continue; //Skip if function is never called  
+            if(!reachableFuncs.count(&F)) continue; //Skip if function is never called  
+            if(!CATFuncs.count(&F)) continue;
             errs()<<"\n\nCAT_Transform Pass for :"<<F.getName();      
+            beginFunction(F);
             modified |= ConstArgPropogation(F); //nonCAT inter-procedural constant propogation done first
             modified |= CATFuncTransform(F); //Constant propogation and folding pass    
+            endFunction(F);
         }   
         return modified;
     }
@@ -601,11 +1749,13 @@ namespace {
             modified = true;
         }
 
+        modified |= immediateOperands(F); //leaves the constant CAT_news to DCE
+
         modified |= deadCodeElimination(F); 
 
         modified |= constantFoldnonCAT(F);   
          
-        modified |= deleteCondBrs(F);    
+        modified |= foldTerminators(F);    
 
         return modified;
     }  
@@ -613,7 +1763,9 @@ namespace {
 
     void CATFuncAnalyse(Function &F){
         errs()<<"\n\nCATFuncAnalyse for :"<<F.getName();
+        if(summaryNode[&F] == NULL) summaryNode[&F] = new FunctionSummary(); //clones are created after doInitialization
         FunctionSummary* sumF = summaryNode[&F];
+        sumF->analysed = true;
         sumF->aliasAnalysis = &(getAnalysis< AAResultsWrapperPass >(F).getAAResults());
         bool isCATbb = false;
         unsigned instCount = 0;
@@ -624,11 +1776,8 @@ namespace {
                 sumF->indexMap[&i] = instCount++;
                 if(auto *call = dyn_cast<CallInst>(&i)){
                     Function* calleeF = call->getCalledFunction();
-                    if( (calleeF == CAT_new) ||
-                        (calleeF == CAT_add) ||
-                        (calleeF == CAT_sub) ||
-                        (calleeF == CAT_set) ||
-                        (calleeF == CAT_get)){ 
+                    CATOpKind kind = classifyCall(call);
+                    if(isCATOp(kind)){ 
                         currentCATInsts.push_back(&i);
                         isCATbb = true;
                         // errs()<<"\n nonCATcall: \t";
@@ -636,7 +1785,7 @@ namespace {
                     }
                     else{
                         sumF->nonCATCalls.insert(call);
-                        if(!calleeF->isDeclaration()){
+                        if((calleeF == NULL) || !calleeF->isDeclaration()){
                             currentCATInsts.push_back(&i);
                             isCATbb = true;
                         }
@@ -649,13 +1798,15 @@ namespace {
                 }
                 else if (auto store = dyn_cast<StoreInst>(&i)){
                     sumF->storeInsts.push_back(store);
+                    sumF->storesByPointer[store->getPointerOperand()].push_back(store);
+                    sumF->storesByValue[store->getValueOperand()].push_back(store);
                     sumF->memInsts.push_back(&i);
                     // errs()<<"\n store: \t";
                     // I->print(errs());
                 }
                 else if (auto phiInst = dyn_cast<PHINode>(&i)){   
-                    if (auto* callPhi = dyn_cast<CallInst>(phiInst->getIncomingValue(0))) {
-                        if(callPhi->getCalledFunction() == CAT_new){
+                    if (isa<CallInst>(phiInst->getIncomingValue(0))) {
+                        if(getOpKind(phiInst->getIncomingValue(0)) == CATNewOp){
                             currentCATInsts.push_back(&i);
                             isCATbb = true;
                         }
@@ -701,6 +1852,46 @@ namespace {
     void computeAliases(Function &F){
 
         errs()<<"\nComputing Alias sets for "<<F.getName();
+        FunctionSummary* sumF = summaryNode[&F];
+        if(useCATPointsTo(F))
+            computePointsToAliases(F);
+        else
+            computeAAAliases(F);
+
+        for(auto call : sumF->nonCATCalls){
+            for (int i = 0; i < call->getNumArgOperands(); i++) {
+                auto storesToArg = sumF->storesByPointer.find(call->getArgOperand(i));
+                if(storesToArg == sumF->storesByPointer.end()) continue;
+                for(auto store : storesToArg->second){
+                    switch(sumF->aliasAnalysis->getModRefInfo(call ,MemoryLocation::get(store))){
+                        case ModRefInfo::Mod: 
+                        case ModRefInfo::Ref: 
+                        case ModRefInfo::ModRef: 
+                        case ModRefInfo::MustMod: 
+                        case ModRefInfo::MustRef: 
+                        case ModRefInfo::MustModRef:
+                            sumF->escapedStores.insert(store);
+                            break;
+                        default:
+                            break;
+                    }       
+                }  
+            }
+        }
+    }
+
+
+    bool useCATPointsTo(Function &F){
+        if(CATAliasSrc == AliasPTA) return true;
+        for(auto &name : CATPTAFuncs){
+            if(F.getName() == name) return true;
+        }
+        return false;
+    }
+
+
+    void computeAAAliases(Function &F){
+
         FunctionSummary* sumF = summaryNode[&F];
         for(auto memInst1 : sumF->memInsts){
             for (auto memInst2 : sumF->memInsts){
@@ -752,48 +1943,106 @@ namespace {
                 }
             }
         }
-
-        for(auto call : sumF->nonCATCalls){
-            for (int i = 0; i < call->getNumArgOperands(); i++) {
-                for(auto store : sumF->storeInsts){
-                    if(call->getArgOperand(i) == store->getPointerOperand()){
-                        switch(sumF->aliasAnalysis->getModRefInfo(call ,MemoryLocation::get(store))){
-                            case ModRefInfo::Mod: 
-                            case ModRefInfo::Ref: 
-                            case ModRefInfo::ModRef: 
-                            case ModRefInfo::MustMod: 
-                            case ModRefInfo::MustRef: 
-                            case ModRefInfo::MustModRef:
-                                sumF->escapedStores.insert(store);
-                                break;
-                            default:
-                                break;
-                        }       
-                    }                                 
-                }  
-            }
-        }
     }
 
 
-    void computeGenKill(Function &F){
-        errs()<<"\nComputing GenKill sets for "<<F.getName();
+    void computePointsToAliases(Function &F){ //Near-linear replacement for the pairwise AA queries, looks through bitcasts
+
         FunctionSummary* sumF = summaryNode[&F];
-        for(auto bb : sumF->CATbbs){
-            for(auto i : sumF->CATInsts[bb]){
-                if(CallInst *callInst = dyn_cast<CallInst>(i)){
-                    Function* calleeF = callInst->getCalledFunction();
-                    if((calleeF == CAT_add) || 
-                        (calleeF == CAT_sub) || 
-                        (calleeF == CAT_set)){
-                        sumF->genInst[i].set(sumF->indexMap[i]);
-                        markKills(i);
-                    }
-                    else if(calleeF == CAT_new){
-                        sumF->genInst[i].set(sumF->indexMap[i]);
-                        markKills(i);
- 
-                    }                   
+        CATPointsTo PT;
+        for(auto &arg : F.args()){
+            if(arg.getType()->isPointerTy())
+                PT.unify(PT.getNode(&arg), PT.unknown);
+        }
+        for(auto &bb : F){
+            for(auto &i : bb){
+                for(auto &op : i.operands()){ //globals and constant pointer expressions are visible to the whole program
+                    Value* opV = op.get()->stripPointerCasts();
+                    if(!opV->getType()->isPointerTy()) continue;
+                    if(isa<GlobalVariable>(opV) || isa<ConstantExpr>(opV))
+                        PT.unify(PT.getNode(opV), PT.unknown);
+                }
+                if(auto load = dyn_cast<LoadInst>(&i)){
+                    PT.unify(PT.getNode(load), PT.getPointee(PT.getNode(load->getPointerOperand())));
+                }
+                else if(auto store = dyn_cast<StoreInst>(&i)){
+                    PT.unify(PT.getNode(store->getValueOperand()), PT.getPointee(PT.getNode(store->getPointerOperand())));
+                }
+                else if(auto phiInst = dyn_cast<PHINode>(&i)){
+                    for(auto &incoming : phiInst->incoming_values()){
+                        PT.unify(PT.getNode(phiInst), PT.getNode(incoming));
+                    }
+                }
+                else if(auto selectInst = dyn_cast<SelectInst>(&i)){
+                    PT.unify(PT.getNode(selectInst), PT.getNode(selectInst->getTrueValue()));
+                    PT.unify(PT.getNode(selectInst), PT.getNode(selectInst->getFalseValue()));
+                }
+                else if(auto gep = dyn_cast<GetElementPtrInst>(&i)){ //field-insensitive
+                    PT.unify(PT.getNode(gep), PT.getNode(gep->getPointerOperand()));
+                }
+                else if(isa<IntToPtrInst>(&i) || isa<PtrToIntInst>(&i)){
+                    PT.unify(PT.getNode(&i), PT.unknown);
+                    PT.unify(PT.getNode(i.getOperand(0)), PT.unknown);
+                }
+                else if(auto call = dyn_cast<CallInst>(&i)){
+                    if(isCATOp(getOpKind(call))) continue; //CAT calls never move handles
+                    for(int argNo = 0; argNo < call->getNumArgOperands(); argNo++){
+                        Value* arg = call->getArgOperand(argNo);
+                        if(arg->getType()->isPointerTy())
+                            PT.unify(PT.getNode(arg), PT.unknown);
+                    }
+                    if(call->getType()->isPointerTy())
+                        PT.unify(PT.getNode(call), PT.unknown);
+                }
+            }
+        }
+
+        auto getAliasDef = [](Instruction* memInst) -> Instruction* {
+            if(StoreInst* store = dyn_cast<StoreInst>(memInst))
+                return dyn_cast<Instruction>(store->getValueOperand()->stripPointerCasts());
+            return memInst;
+        };
+        auto getSlot = [](Instruction* memInst) -> Value* {
+            if(StoreInst* store = dyn_cast<StoreInst>(memInst))
+                return store->getPointerOperand()->stripPointerCasts();
+            return cast<LoadInst>(memInst)->getPointerOperand()->stripPointerCasts();
+        };
+
+        std::unordered_map<unsigned, std::vector<Instruction*>> slotClasses;
+        for(auto memInst : sumF->memInsts){
+            slotClasses[PT.getNode(getSlot(memInst))].push_back(memInst);
+        }
+        for(auto &slotClass : slotClasses){
+            for(auto memInst1 : slotClass.second){
+                Instruction* Alias1 = getAliasDef(memInst1);
+                if(Alias1 == NULL) continue;
+                for(auto memInst2 : slotClass.second){
+                    if(memInst1 == memInst2) continue;
+                    Instruction* Alias2 = getAliasDef(memInst2);
+                    if(Alias2 == NULL) continue;
+                    sumF->mayMustAliases[Alias1].insert(Alias2);
+                    if(getSlot(memInst1) == getSlot(memInst2))
+                        sumF->mustAliases[Alias1].insert(Alias2);
+                }
+            }
+        }
+    }
+
+
+    void computeGenKill(Function &F){
+        errs()<<"\nComputing GenKill sets for "<<F.getName();
+        FunctionSummary* sumF = summaryNode[&F];
+        for(auto bb : sumF->CATbbs){
+            for(auto i : sumF->CATInsts[bb]){
+                if(isa<CallInst>(i)){
+                    CATOpKind kind = getOpKind(i);
+                    if(isCATDef(kind)){
+                        sumF->genInst[i].set(sumF->indexMap[i]);
+                        markKills(i);
+                    }
+                    else if(!isCATOp(kind) && callMayModifyCAT(cast<CallInst>(i), NULL)){
+                        sumF->genInst[i].set(sumF->indexMap[i]); //never killed, lets CAT_get copy propagation see the call
+                    }
                 }
                 else if(PHINode *phiInst = dyn_cast<PHINode>(i)){
                     sumF->genInst[i].set(sumF->indexMap[i]);
@@ -825,10 +2074,12 @@ namespace {
         FunctionSummary* sumF = summaryNode[F];
         Instruction* defInst;
         if(CallInst *callInst = dyn_cast<CallInst>(i)){
-            if(callInst->getCalledFunction() == CAT_new){
+            CATOpKind kind = getOpKind(callInst);
+            if(kind == CATNewOp){
                 defInst = callInst;
             }
-            else if(!(defInst = dyn_cast<Instruction>(callInst->getArgOperand(0)))) return;  
+            else if(!isCATRedef(kind)) return;
+            else if(!(defInst = dyn_cast<Instruction>(callInst->getArgOperand(CATOpTable[kind].destOperand)))) return;  
         }
         else if(isa<PHINode>(i)){
             defInst = i;
@@ -840,11 +2091,9 @@ namespace {
         for(auto &U : defInst->uses()){
             User* user = U.getUser();
             if (auto *useInst = dyn_cast<CallInst>(user)){ 
-                Function* calleeF = useInst->getCalledFunction(); 
-                if((calleeF == CAT_add) || 
-                    (calleeF == CAT_sub) || 
-                    (calleeF == CAT_set)){
-                    if(useInst->getArgOperand(0) == defInst){
+                CATOpKind useKind = getOpKind(useInst);
+                if(isCATRedef(useKind)){
+                    if(useInst->getArgOperand(CATOpTable[useKind].destOperand) == defInst){
 
                         sumF->killInst[i].set(sumF->indexMap[useInst]);
                     }
@@ -872,11 +2121,9 @@ namespace {
                 for(auto &U : aliasInst->uses()){
                     User* user = U.getUser();
                     if (auto *useInst = dyn_cast<CallInst>(user)){ 
-                        Function* calleeF = useInst->getCalledFunction(); 
-                        if((calleeF == CAT_add) || 
-                                (calleeF == CAT_sub) || 
-                                (calleeF == CAT_set)){
-                            if(useInst->getArgOperand(0) == aliasInst){
+                        CATOpKind useKind = getOpKind(useInst);
+                        if(isCATRedef(useKind)){
+                            if(useInst->getArgOperand(CATOpTable[useKind].destOperand) == aliasInst){
                                 sumF->killInst[i].set(sumF->indexMap[useInst]);
                             }
                         }
@@ -958,7 +2205,7 @@ namespace {
             for(auto i : sumF->CATInsts[bb]){
                 if(CallInst *callInst = dyn_cast<CallInst>(i)){
                     Value *constant_to_propogate = NULL;
-                    if(callInst->getCalledFunction() == CAT_get){
+                    if(getOpKind(callInst) == CATGetOp){
                         if(isa<ConstantPointerNull>(callInst->getArgOperand(0))){
                             auto retType = dyn_cast<IntegerType>(callInst->getCalledFunction()->getReturnType());
                             sumF->propogatedConstants[i] = ConstantInt::get(retType,0, true);
@@ -986,13 +2233,12 @@ namespace {
         for(auto bb : sumF->CATbbs){
             for(auto i : sumF->CATInsts[bb]){
                 if(auto callInst = dyn_cast<CallInst>(i)){
-                    if(callInst->getCalledFunction() != CAT_new) continue;
+                    if(getOpKind(callInst) != CATNewOp) continue;
                     std::vector<CallInst*> catGETS;
                     for (auto &U : callInst->uses()) {
                         User* user = U.getUser();
                         if (auto *useInst = dyn_cast<CallInst>(user)){
-                            Function* useCallee = useInst->getCalledFunction();  
-                            if((useCallee != CAT_get)) continue;
+                            if(getOpKind(useInst) != CATGetOp) continue;
                             catGETS.push_back(useInst);
                             
                         }
@@ -1008,11 +2254,11 @@ namespace {
                                 InSetDiff &= sumF->inInst[get2];
                                  for(auto in : InSetDiff.set_bits()){
                                     if(CallInst *callInst_in = dyn_cast<CallInst>(sumF->Insts[in])){
-                                        Function* calleeF = callInst_in->getCalledFunction();
-                                        if((calleeF == CAT_set) || (calleeF == CAT_add) || (calleeF == CAT_sub)){
+                                        CATOpKind kind = getOpKind(callInst_in);
+                                        if(isCATRedef(kind)){
                                             canReplace = false;
                                         }
-                                        else if(!calleeF->isDeclaration()){
+                                        else if(!isCATOp(kind) && callMayModifyCAT(callInst_in, defVar)){
                                             canReplace = false;
                                         }
                                     }
@@ -1041,17 +2287,19 @@ namespace {
         for(auto bb : sumF->CATbbs){
             for(auto i : sumF->CATInsts[bb]){
                 if(CallInst *callInst = dyn_cast<CallInst>(i)){
-                    Function* calleeF = callInst->getCalledFunction();
-                    if((calleeF == CAT_add) || (calleeF == CAT_sub)){             
-                        Value *op1 = getConstant(i, 1, false);
-                        Value *op2 = getConstant(i, 2, false);
+                    CATOpKind kind = getOpKind(callInst);
+                    if((kind == CATAddOp) || (kind == CATSubOp) || (kind == CATAddImmOp) || (kind == CATSubImmOp)){             
+                        Value *op1 = getConstant(i, CATOpTable[kind].srcOperands[0], false);
+                        Value *op2 = NULL;
+                        if(CATOpTable[kind].srcOperands[1] >= 0) op2 = getConstant(i, CATOpTable[kind].srcOperands[1], false);
+                        else op2 = dyn_cast<ConstantInt>(callInst->getArgOperand(2)); //immediate operand
           
                         if((op1 != NULL) && (op2 != NULL)){
                             ConstantInt* const1 = dyn_cast<ConstantInt>(op1);
                             ConstantInt* const2 = dyn_cast<ConstantInt>(op2);
 
                             ConstantInt* result = NULL;
-                            if(calleeF == CAT_add)
+                            if((kind == CATAddOp) || (kind == CATAddImmOp))
                                 result = ConstantInt::get(const1->getType(),const1->getSExtValue() + const2->getSExtValue());
                             else
                                 result = ConstantInt::get(const1->getType(),const1->getSExtValue() - const2->getSExtValue());
@@ -1059,7 +2307,7 @@ namespace {
                             modified = true;
                         }                       
                     }
-                    else if(calleeF == CAT_set){
+                    else if(kind == CATSetOp){
                         Value *constant_to_propogate = NULL;
                         ConstantInt* constSet;
                         if(!(constSet = dyn_cast<ConstantInt>(callInst->getArgOperand(1)))) continue;
@@ -1156,12 +2404,10 @@ namespace {
 
             for(auto in : sumF->inInst[i].set_bits()){
                 if(CallInst *callInst_in = dyn_cast<CallInst>(sumF->Insts[in])){
-                    Function* calleeF = callInst_in->getCalledFunction();
-                    if((calleeF == CAT_add) || 
-                        (calleeF == CAT_sub) ||
-                        (calleeF == CAT_set)){
+                    CATOpKind kind = getOpKind(callInst_in);
+                    if(isCATRedef(kind)){
 
-                        if(callInst_in->getArgOperand(0) == inpArg){
+                        if(callInst_in->getArgOperand(CATOpTable[kind].destOperand) == inpArg){
                             getArgConst = false;                                             
                         }
                     }
@@ -1244,8 +2490,8 @@ namespace {
 
         for(auto in : sumF->inInst[i].set_bits()){
             if(CallInst *callInst_in = dyn_cast<CallInst>(Insts[in])){
-                Function* calleeF = callInst_in->getCalledFunction();
-                if(calleeF == CAT_new){
+                switch(getOpKind(callInst_in)){
+                case CATNewOp:
                     if( ((Insts[in] == defVar) && (!defEscapes)) || ((Insts[in] == aliasInst) && (!aliasInstEscapes)) ){   
                         if(isa<ConstantInt>(callInst_in->getArgOperand(0))){
                             constants.push_back((ConstantInt*)callInst_in->getArgOperand(0));
@@ -1254,8 +2500,8 @@ namespace {
                             return false;
                         }                       
                     }                   
-                }
-                else if(calleeF == CAT_set){
+                    break;
+                case CATSetOp:
                     if(auto *setVar = dyn_cast<Instruction>(callInst_in->getArgOperand(0))){
                         if(  ((setVar == defVar) && (!defEscapes)) || ((setVar == aliasInst) && (!aliasInstEscapes))){                             
                             if(isa<ConstantInt>(callInst_in->getArgOperand(1))){
@@ -1266,13 +2512,16 @@ namespace {
                             }                           
                         }                       
                     }
-                }
-                else if((calleeF == CAT_add) || (calleeF == CAT_sub)){
+                    break;
+                case CATAddOp: case CATSubOp: case CATAddImmOp: case CATSubImmOp:
                     if(auto *setVar = dyn_cast<Instruction>(callInst_in->getArgOperand(0))){
                         if((setVar == defVar) || (setVar == aliasInst)){
                             return false;
                         }                       
                     }
+                    break;
+                default:
+                    break;
                 }
             }
             else if(PHINode *curInst = dyn_cast<PHINode>(Insts[in])){               
@@ -1280,7 +2529,7 @@ namespace {
                 if( ((Insts[in] == defVar) && (!defEscapes)) || ((Insts[in] == aliasInst) && (!aliasInstEscapes))){          
                     for(int index = 0; index < curInst->getNumIncomingValues(); index++){
                         if(auto *incVar = dyn_cast<CallInst>(curInst->getIncomingValue(index))){
-                            if(incVar->getCalledFunction() == CAT_new){
+                            if(getOpKind(incVar) == CATNewOp){
                                 if(auto *constantVar = dyn_cast<ConstantInt>(incVar->getArgOperand(0))){
                                     if(PHIvalue == NULL){
                                         PHIvalue = constantVar;
@@ -1309,6 +2558,24 @@ namespace {
     }
 
 
+    bool isNonEscapingParam(Function* F, unsigned argNo){
+        if(F == NULL) return false;
+        auto effects = funcEffects.find(F);
+        if(effects == funcEffects.end()) return false;
+        if(argNo >= effects->second.paramEffects.size()) return false;
+        return (effects->second.paramEffects[argNo] & ParamEscapes) == 0;
+    }
+
+
+    bool isReadOnlyParam(Function* F, unsigned argNo){
+        if(F == NULL) return false;
+        auto effects = funcEffects.find(F);
+        if(effects == funcEffects.end()) return false;
+        if(argNo >= effects->second.paramEffects.size()) return false;
+        return (effects->second.paramEffects[argNo] & (ParamWritten | ParamEscapes)) == 0;
+    }
+
+
     bool isEscapedVar(Instruction* defVar){ //Check if the variable escapes(ModRef) the function  since this is a conservative intra-procedural pass
         
         if (defVar == NULL) return false;
@@ -1322,11 +2589,7 @@ namespace {
             // errs()<<"\n";
             if(auto *useVar = dyn_cast<CallInst>(U.getUser())){
                 Function* calleeF = useVar->getCalledFunction();
-                if((calleeF != CAT_new) &&
-                    (calleeF != CAT_add) &&
-                    (calleeF != CAT_sub) &&
-                    (calleeF != CAT_set) &&
-                    (calleeF != CAT_get)){
+                if(!isCATOp(getOpKind(useVar))){
                     bool inputPropogated = false;
                     if(summaryNode.find(calleeF) != summaryNode.end()){
                         if(summaryNode[calleeF]->funcInputArgs.find(U.getOperandNo()) != summaryNode[useVar->getCalledFunction()]->funcInputArgs.end()){
@@ -1341,6 +2604,9 @@ namespace {
                             }
                         }
                     }
+                    if(!inputPropogated && isReadOnlyParam(calleeF, U.getOperandNo())){
+                        inputPropogated = true; //the callee only reads it, constant facts survive the call
+                    }
                     if(!inputPropogated){
                         auto sizePointer = getPointedElementTypeSize(defVar);
                         switch(sumF->aliasAnalysis->getModRefInfo(useVar ,defVar, sizePointer)){
@@ -1392,21 +2658,15 @@ namespace {
 
     bool checkEscapedStores(StoreInst* defStore){ //recursively check for escaped stores
         FunctionSummary* sumF = summaryNode[defStore->getFunction()];
-        std::vector<StoreInst*> storeInsts = sumF->storeInsts;
-        std::set< StoreInst* > escapedStores =  sumF->escapedStores;
-        for(auto store : storeInsts){
-            if(store->getValueOperand() == defStore->getPointerOperand()){
-                if( escapedStores.find(store) !=  escapedStores.end()) {
-                    // errs()<<"\nFound an Escaped Store through recursive check: \t" ;
-                    // store->print(errs());
-                    return true;                    
-                }
-                else{
-                    return checkEscapedStores(store);   
-                }
-            }
-        }
-        return false;
+        auto storesOfSlot = sumF->storesByValue.find(defStore->getPointerOperand());
+        if(storesOfSlot == sumF->storesByValue.end()) return false;
+        StoreInst* store = storesOfSlot->second.front();
+        if(sumF->escapedStores.find(store) != sumF->escapedStores.end()) {
+            // errs()<<"\nFound an Escaped Store through recursive check: \t" ;
+            // store->print(errs());
+            return true;                    
+        }
+        return checkEscapedStores(store);
     }
 
 
@@ -1418,6 +2678,7 @@ namespace {
             errs()<<"\nReplaced all uses of instruction: "; 
             i.first->print(errs());  
             errs()<<" with value "<<const1->getSExtValue()<<" by Constant Propogation";               
+            NumGetsFolded++;
             BasicBlock::iterator ii(i.first);
             ReplaceInstWithValue(i.first->getParent()->getInstList(), ii, i.second);                    
         }
@@ -1433,6 +2694,7 @@ namespace {
             errs()<<" with ";
             get.second->print(errs()); 
             errs()<<" by Copy Propogation";               
+            NumGetsCopied++;
             BasicBlock::iterator ii(get.first);
             ReplaceInstWithValue(get.first->getParent()->getInstList(), ii, get.second); 
         }
@@ -1453,6 +2715,7 @@ namespace {
             Instruction* CatSet =  cast<Instruction>(builder.CreateCall(CAT_set, ArrayRef<Value *>(args)));
             errs()<<"\t with ";
             CatSet->print(errs());
+            NumOpsFolded++;
         }
         for(auto &i : sumF->foldedConstants){
             i.first->eraseFromParent();
@@ -1463,234 +2726,975 @@ namespace {
     }
 
 
-    bool deadCodeElimination(Function &F){ //Path-insensitive DCE 
+    bool immediateOperands(Function &F){ //CAT_add/CAT_sub reading a constant CAT object that is never redefined take the constant directly
 
-        bool flag = true;
         bool modified = false;
-        std::set<Instruction *> toDelete;
-        FunctionSummary* sumF = summaryNode[&F];
-        while(flag){
-            flag = false;
+        std::vector<CallInst*> candidates;
+        for(auto &bb : F){
+            for(auto &i : bb){
+                CATOpKind kind = getOpKind(&i);
+                if((kind == CATAddOp) || (kind == CATSubOp)) candidates.push_back(cast<CallInst>(&i));
+            }
+        }
+
+        for(auto call : candidates){
+            CATOpKind kind = getOpKind(call);
+            Value* var = call->getArgOperand(1);
+            ConstantInt* imm = getImmutableConstant(call->getArgOperand(2));
+            if((imm == NULL) && (kind == CATAddOp)){ //addition commutes
+                imm = getImmutableConstant(call->getArgOperand(1));
+                var = call->getArgOperand(2);
+            }
+            if(imm == NULL) continue;
+            IRBuilder<>builder(call);
+            std::vector<Value*> args;
+            args.push_back(call->getArgOperand(0));
+            args.push_back(var);
+            args.push_back(imm);
+            Function* immF = (kind == CATAddOp) ? CAT_add_imm : CAT_sub_imm;
+            Instruction* immCall = cast<Instruction>(builder.CreateCall(immF, ArrayRef<Value *>(args)));
+            errs()<<"\nImmediate operand: ";
+            call->print(errs());
+            errs()<<"\t with ";
+            immCall->print(errs());
+            call->eraseFromParent();
+            NumImmediateOperands++;
+            modified = true;
+        }
+        return modified;
+    }
+
+
+    ConstantInt* getImmutableConstant(Value* v){ //The constant of a CAT_new that is only ever read
+        auto def = dyn_cast<CallInst>(v);
+        if((def == nullptr) || (getOpKind(def) != CATNewOp)) return NULL;
+        auto constant = dyn_cast<ConstantInt>(def->getArgOperand(0));
+        if((constant == NULL) || !isReadOnlyCAT(def)) return NULL;
+        return constant;
+    }
+
+
+    bool isReadOnlyCAT(CallInst* def){
+        for(auto &U : def->uses()){
+            User* user = U.getUser();
+            CATOpKind useKind = getOpKind(user);
+            if(useKind == CATGetOp) continue;
+            if(isCATRedef(useKind) && ((int)U.getOperandNo() != CATOpTable[useKind].destOperand)) continue;
+            if(!isCATOp(useKind) && isa<CallInst>(user)){
+                if(isReadOnlyParam(cast<CallInst>(user)->getCalledFunction(), U.getOperandNo())) continue;
+            }
+            return false; //redefined, stored, returned, merged by a phi or handed to a callee that may write it
+        }
+        return true;
+    }
+
+
+    bool hoistLoopAllocations(Module &M){ //A CAT_new whose object dies with the iteration is moved to the preheader, and reset on the backedge
+
+        bool modified = false;
+        for(auto &F : M){
+            if(F.isDeclaration() || !reachableFuncs.count(&F)) continue;
+            if(!directCATCalls.count(&F)) continue;
+            auto& LI = getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo();
+            if(LI.empty()) continue;
+            auto& DT = getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+
+            std::vector<CallInst*> worklist;
             for(auto &bb : F){
+                if(LI.getLoopFor(&bb) == NULL) continue;
                 for(auto &i : bb){
-                    if(CallInst *callInst = dyn_cast<CallInst>(&i)){
-                        Function* calleeF = callInst->getCalledFunction();
-                        if((calleeF != CAT_new) &&
-                            (calleeF != CAT_add) &&
-                            (calleeF != CAT_sub) &&
-                            (calleeF != CAT_set) &&
-                            (calleeF != CAT_get)){
-
-                            if (isDeadCall(F, callInst)){
-                                toDelete.insert(callInst);
-                                continue;
-                            }
-                        }
-                        else if(calleeF == CAT_new){
-                            if(callInst->getNumUses() == 0){
-                                toDelete.insert(callInst);
-                                continue;
-                            }
-                            else{
-                                std::set<Instruction *> tempDelete;
-                                for (auto &U : callInst->uses()) {
-                                    User* user = U.getUser();
-                                    if (auto *useInst = dyn_cast<CallInst>(user)){
-                                        Function* useCallee = useInst->getCalledFunction();  
-                                        if((useCallee == CAT_add) || 
-                                            (useCallee == CAT_sub) || 
-                                            (useCallee == CAT_set)){
-                                            if(useInst->getArgOperand(0) != callInst){
-                                                tempDelete.clear();
-                                                break;
-                                            }
-
-                                            bool aliasDependence = false;
-                                            if (sumF->mayMustAliases.find(callInst) != sumF->mayMustAliases.end()){
-                                                for (auto aliasInst : sumF->mayMustAliases[callInst]){
-
-                                                    for (auto &AliasUser : aliasInst->uses()) {
-                                                        if (auto *AliasUseInst = dyn_cast<CallInst>(AliasUser.getUser())){  
-                                                            if(AliasUseInst->getCalledFunction() == CAT_get){
-                                                                aliasDependence = true;
-                                                                break;
-                                                            }
-                                                        }
-                                                    }
-                                                }
-                                            }
-                                            if(aliasDependence){
-                                                tempDelete.clear();
-                                                break;
-                                            }
-
-                                            tempDelete.insert(useInst);
-                                        }
-                                        if(useCallee == CAT_get){
-                                            if(useInst->getArgOperand(0) == callInst){
-                                                tempDelete.clear();
-                                                break;
-                                            }
-                                        }
-                                    }     
-                                }
-                                toDelete.insert(tempDelete.begin(), tempDelete.end());
-                            }
+                    if(getOpKind(&i) == CATNewOp) worklist.push_back(cast<CallInst>(&i));
+                }
+            }
+
+            while(!worklist.empty()){
+                CallInst* def = worklist.back();
+                worklist.pop_back();
+                Loop* L = LI.getLoopFor(def->getParent());
+                if(L == NULL) continue;
+                BasicBlock* preheader = L->getLoopPreheader();
+                BasicBlock* latch = L->getLoopLatch();
+                if((preheader == NULL) || (latch == NULL) || !isIterationLocal(def, L)) continue;
+                if(!runsEveryIteration(def, L, DT)) continue; //otherwise the preheader CAT_new could add an invocation
+
+                Value* init = def->getArgOperand(0); //the value of the first iteration, then of the next one on each backedge
+                Value* next = init;
+                if(!L->isLoopInvariant(init)){
+                    auto phi = dyn_cast<PHINode>(init);
+                    if((phi == NULL) || (phi->getParent() != L->getHeader())) continue;
+                    init = phi->getIncomingValueForBlock(preheader);
+                    next = phi->getIncomingValueForBlock(latch);
+                }
+
+                IRBuilder<>builder(preheader->getTerminator());
+                CallInst* handle = builder.CreateCall(CAT_new, ArrayRef<Value *>(init));
+                BasicBlock* backedge = (latch->getSingleSuccessor() == L->getHeader()) ? latch : SplitEdge(latch, L->getHeader(), &DT, &LI);
+                std::vector<Value*> args;
+                args.push_back(handle);
+                args.push_back(next);
+                IRBuilder<>setBuilder(backedge->getTerminator());
+                setBuilder.CreateCall(CAT_set, ArrayRef<Value *>(args));
+                errs()<<"\nHoisting loop allocation: ";
+                def->print(errs());
+                errs()<<"\t to "<<preheader->getName();
+
+                handle->takeName(def);
+                def->replaceAllUsesWith(handle);
+                def->eraseFromParent();
+                NumAllocationsHoisted++;
+                worklist.push_back(handle); //may leave the enclosing loop too
+                modified = true;
+            }
+        }
+        return modified;
+    }
+
+
+    bool runsEveryIteration(Instruction* I, Loop* L, DominatorTree &DT){ //I runs once per iteration, and at least once whenever L is entered
+        if(!DT.dominates(I->getParent(), L->getLoopLatch())) return false;
+        SmallVector<BasicBlock*, 4> exiting;
+        L->getExitingBlocks(exiting);
+        for(auto bb : exiting){
+            if(!DT.dominates(I->getParent(), bb)) return false;
+        }
+        return true;
+    }
+
+
+    bool isIterationLocal(CallInst* def, Loop* L){ //Only used inside L, never carried to the next iteration or stashed away
+        for(auto &U : def->uses()){
+            auto user = dyn_cast<Instruction>(U.getUser());
+            if((user == nullptr) || !L->contains(user)) return false;
+            if(isa<PHINode>(user)) return false;
+            CATOpKind useKind = getOpKind(user);
+            if(useKind == CATFreeOp) return false; //a shared object must outlive the loop
+            if(isCATOp(useKind)) continue;
+            if(auto call = dyn_cast<CallInst>(user)){
+                if(isNonEscapingParam(call->getCalledFunction(), U.getOperandNo())) continue;
+            }
+            return false; //stored, returned, or handed to code that may keep it
+        }
+        return true;
+    }
+
+
+    bool coalesceCATObjects(Module &M){ //Stack-coloring style: greedy classes of non-interfering CAT_news, led by a dominating one
+
+        bool modified = false;
+        for(auto &F : M){
+            if(F.isDeclaration() || !reachableFuncs.count(&F)) continue;
+            if(!directCATCalls.count(&F)) continue;
+            auto& DT = getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+
+            std::vector<CallInst*> candidates; //in dominator-tree preorder, so a class leader precedes what it dominates
+            std::unordered_map<Instruction*, unsigned> candidateIndex;
+            for(auto node : depth_first(DT.getRootNode())){
+                for(auto &i : *node->getBlock()){
+                    if(getOpKind(&i) != CATNewOp) continue;
+                    if(!isLocalCATObject(cast<CallInst>(&i))) continue;
+                    candidateIndex[&i] = candidates.size();
+                    candidates.push_back(cast<CallInst>(&i));
+                }
+            }
+            if(candidates.size() < 2) continue;
+
+            std::unordered_map<BasicBlock*, llvm::BitVector> liveIn, liveOut;
+            computeCATLiveness(F, candidates, candidateIndex, liveIn, liveOut);
+            auto isLiveAfter = [&](Instruction* obj, Instruction* I){
+                BasicBlock* bb = I->getParent();
+                bool usedAfter = false;
+                for(auto it = ++I->getIterator(); it != bb->end(); ++it){
+                    if(&*it == obj) return false; //defined later in the block
+                    if(is_contained(it->operands(), obj)) usedAfter = true;
+                }
+                if((obj->getParent() != bb) && !liveIn[bb][candidateIndex[obj]]) return false;
+                return usedAfter || liveOut[bb][candidateIndex[obj]];
+            };
+
+            std::vector<std::vector<CallInst*>> classes;
+            for(auto obj : candidates){
+                bool placed = false;
+                for(auto &cls : classes){
+                    if(!DT.dominates(cls.front(), obj)) continue;
+                    bool interferes = false;
+                    for(auto member : cls){ //SSA live ranges intersect iff one is live at the other's definition
+                        if(isLiveAfter(member, obj) || isLiveAfter(obj, member)){
+                            interferes = true;
+                            break;
                         }
                     }
-                    else if(PHINode *PHIInst = dyn_cast<PHINode>(&i)){
-                       if(PHIInst->getNumUses() == 0){
-                            toDelete.insert(PHIInst);
-                            continue;
-                        }   
-                    }
+                    if(interferes) continue;
+                    cls.push_back(obj);
+                    placed = true;
+                    break;
+                }
+                if(!placed) classes.push_back(std::vector<CallInst*>(1, obj));
+            }
+
+            for(auto &cls : classes){
+                CallInst* leader = cls.front();
+                for(unsigned m = 1; m < cls.size(); m++){
+                    CallInst* member = cls[m];
+                    std::vector<Value*> args;
+                    args.push_back(leader);
+                    args.push_back(member->getArgOperand(0));
+                    IRBuilder<>builder(member);
+                    builder.CreateCall(CAT_set, ArrayRef<Value *>(args));
+                    errs()<<"\nCoalescing CAT object: ";
+                    member->print(errs());
+                    errs()<<"\t into ";
+                    leader->print(errs());
+                    member->replaceAllUsesWith(leader);
+                    member->eraseFromParent();
+                    NumObjectsCoalesced++;
+                    modified = true;
                 }
             }
+        }
+        return modified;
+    }
 
 
-            for (auto I : toDelete) {
-                errs()<<"\n Deleted instruction: ";
-                I->print(errs());
-                errs()<<"  by DCE";
-               
+    bool insertCATFrees(Module &M){ //CAT_free after the last use of each non-escaping object, on every path out of its live range
+
+        bool modified = false;
+        for(auto &F : M){
+            if(F.isDeclaration() || !reachableFuncs.count(&F)) continue;
+            if(!directCATCalls.count(&F)) continue;
+
+            std::vector<CallInst*> objs;
+            std::unordered_map<Instruction*, unsigned> objIndex;
+            for(auto &bb : F){
+                for(auto &i : bb){
+                    if(getOpKind(&i) != CATNewOp) continue;
+                    if(!isLocalCATObject(cast<CallInst>(&i))) continue;
+                    objIndex[&i] = objs.size();
+                    objs.push_back(cast<CallInst>(&i));
+                }
             }
+            if(objs.empty()) continue;
 
-            for (auto I : toDelete) {
-                I->eraseFromParent();
-                flag = true;
+            std::unordered_map<BasicBlock*, llvm::BitVector> liveIn, liveOut;
+            computeCATLiveness(F, objs, objIndex, liveIn, liveOut);
+
+            std::vector<std::pair<Instruction*, CallInst*>> freeBefore;
+            std::map<std::pair<BasicBlock*, BasicBlock*>, std::vector<CallInst*>> freeOnEdge; //the object dies along the edge
+            for(auto &bb : F){
+                for(unsigned idx = 0; idx < objs.size(); idx++){
+                    CallInst* obj = objs[idx];
+                    if((obj->getParent() != &bb) && !liveIn[&bb][idx]) continue;
+                    if(!liveOut[&bb][idx]){
+                        Instruction* lastUse = NULL;
+                        for(auto &i : bb){
+                            if((&i == obj) || is_contained(i.operands(), obj)) lastUse = &i;
+                        }
+                        freeBefore.push_back(std::make_pair(lastUse->getNextNode(), obj));
+                        continue;
+                    }
+                    for(auto succ : successors(&bb)){
+                        if(liveIn[succ][idx]) continue;
+                        auto &dying = freeOnEdge[std::make_pair(&bb, succ)];
+                        if(std::find(dying.begin(), dying.end(), obj) == dying.end()) dying.push_back(obj);
+                    }
+                }
+            }
+
+            for(auto &point : freeBefore){
+                IRBuilder<>builder(point.first);
+                builder.CreateCall(CAT_free, ArrayRef<Value *>(point.second));
+                NumFreesInserted++;
+                modified = true;
+            }
+            for(auto &edge : freeOnEdge){
+                BasicBlock* from = edge.first.first;
+                BasicBlock* to = edge.first.second;
+                BasicBlock* freeBB = (to->getSinglePredecessor() == from) ? to : SplitEdge(from, to);
+                IRBuilder<>builder(&*freeBB->getFirstInsertionPt());
+                for(auto obj : edge.second){
+                    builder.CreateCall(CAT_free, ArrayRef<Value *>(obj));
+                    NumFreesInserted++;
+                }
                 modified = true;
             }
-            toDelete.clear();
+            errs()<<"\nInserted CAT_free for "<<objs.size()<<" objects in "<<F.getName();
         }
-
         return modified;
     }
 
-    bool isDeadCall(Function &F, CallInst* callInst){
-        Function* calleeF = callInst->getCalledFunction();
-        FunctionSummary* sumF = summaryNode[calleeF];
-        if (calleeF == &F) return false; //skip recursive calls
-        if(calleeF->isDeclaration()) return false;
-        if(callInst->getNumUses() != 0) return false;
 
-        for(auto store : sumF->storeInsts){
-            if (isa<GlobalValue>(store->getPointerOperand())) return false;
-        }   
+    bool lowerCATCalls(Module &M){ //get/set/add/sub become loads and stores of the {magic, value} slab object
 
-        for(auto call : sumF->nonCATCalls){
-            if(!isDeadCall(*calleeF, call)) return false;
-        }      
-        
-        for (auto &U : calleeF->uses()){
-            auto user = U.getUser();
-            if (auto recCallInst = dyn_cast<Instruction>(user)){
-                if(recCallInst->getFunction() == calleeF) return false;                  
+        std::vector<CallInst*> toLower;
+        for(auto &F : M){
+            if(F.isDeclaration()) continue;
+            for(auto &bb : F){
+                for(auto &i : bb){
+                    auto call = dyn_cast<CallInst>(&i);
+                    if(call == NULL) continue;
+                    if(call->getMetadata("cat.slowpath") != NULL) continue; //the fallback of an earlier lowering
+                    CATOpKind kind = classifyCall(call);
+                    if(isCATOp(kind) && (kind != CATNewOp) && (kind != CATFreeOp)) toLower.push_back(call);
+                }
             }
         }
+        if(toLower.empty()) return false;
 
-        return true; 
+        Constant* counter = M.getOrInsertGlobal("CAT_invocation_count", IntegerType::get(M.getContext(), 64)); //exported by the non-threaded runtime builds
+        for(auto call : toLower){
+            lowerCATCall(call, classifyCall(call), counter);
+            NumCallsLowered++;
+        }
+        errs()<<"\nLowered "<<toLower.size()<<" CAT calls";
+        return true;
     }
 
 
+    void lowerCATCall(CallInst* call, CATOpKind kind, Constant* counter){ //head -> [validate ->] fast -> tail, failed tests go to the runtime call in slow
+        LLVMContext &C = call->getContext();
+        Type* int64Ty = IntegerType::get(C, 64);
+        Type* objectTy = PointerType::get(int64Ty, 0); //magic word at index 0, value at index 1
+        bool checked = (CATLower == LowerChecked);
+        bool immediate = (kind == CATAddImmOp) || (kind == CATSubImmOp);
+        bool arithmetic = (kind != CATGetOp) && (kind != CATSetOp);
+
+        std::vector<Value*> handles; //what the runtime validates, operands before the result
+        if(arithmetic){
+            handles.push_back(call->getArgOperand(1));
+            if(!immediate) handles.push_back(call->getArgOperand(2));
+        }
+        handles.push_back(call->getArgOperand(0));
+        std::vector<Value*> nullTested; //checked: any NULL handle takes the runtime call, unchecked: NULL operands skip add/sub as the runtime does
+        for(auto handle : handles){
+            if(!checked && (!arithmetic || (handle == call->getArgOperand(0)))) continue;
+            if(getOpKind(handle->stripPointerCasts()) == CATNewOp) continue; //CAT_new never returns NULL
+            if(std::find(nullTested.begin(), nullTested.end(), handle) == nullTested.end()) nullTested.push_back(handle);
+        }
+
+        BasicBlock* head = call->getParent();
+        Function* F = head->getParent();
+        BasicBlock* tail = head->splitBasicBlock(call, "cat.tail");
+        BasicBlock* fast = BasicBlock::Create(C, "cat.fast", F, tail);
+        BasicBlock* validate = checked ? BasicBlock::Create(C, "cat.validate", F, fast) : fast;
+        BasicBlock* slow = NULL;
+        if(checked){
+            slow = BasicBlock::Create(C, "cat.slow", F, tail);
+            call->moveBefore(BranchInst::Create(tail, slow));
+            call->setMetadata("cat.slowpath", MDNode::get(C, {}));
+        }
+
+        Instruction* headBr = head->getTerminator();
+        IRBuilder<> builder(headBr);
+        if(!checked){ //counted even when an operand is NULL
+            builder.CreateStore(builder.CreateAdd(builder.CreateLoad(int64Ty, counter), ConstantInt::get(int64Ty, 1)), counter);
+        }
+        Value* nonNull = NULL;
+        for(auto handle : nullTested){
+            Value* test = builder.CreateIsNotNull(handle);
+            nonNull = (nonNull == NULL) ? test : builder.CreateAnd(nonNull, test);
+        }
+        if(nonNull != NULL) builder.CreateCondBr(nonNull, validate, checked ? slow : tail);
+        else builder.CreateBr(validate);
+        headBr->eraseFromParent();
+
+        if(checked){
+            IRBuilder<> check(validate);
+            Value* valid = NULL;
+            for(auto handle : handles){
+                Value* magic = check.CreateLoad(int64Ty, check.CreatePointerCast(handle, objectTy));
+                Value* test = check.CreateICmpEQ(magic, ConstantInt::get(int64Ty, 0x7036706262556c70ULL)); //VALID_MAGIC of CAT.c
+                valid = (valid == NULL) ? test : check.CreateAnd(valid, test);
+            }
+            check.CreateCondBr(valid, fast, slow);
+        }
 
-    bool constantFoldnonCAT(Function &F){ 
+        IRBuilder<> body(fast);
+        if(checked){
+            body.CreateStore(body.CreateAdd(body.CreateLoad(int64Ty, counter), ConstantInt::get(int64Ty, 1)), counter);
+        }
+        auto valuePtr = [&](Value* handle){
+            return body.CreateInBoundsGEP(int64Ty, body.CreatePointerCast(handle, objectTy), ConstantInt::get(int64Ty, 1));
+        };
+        Value* result = NULL;
+        if(kind == CATGetOp){
+            result = body.CreateLoad(int64Ty, valuePtr(call->getArgOperand(0)));
+        }
+        else if(kind == CATSetOp){
+            body.CreateStore(call->getArgOperand(1), valuePtr(call->getArgOperand(0)));
+        }
+        else{
+            Value* lhs = body.CreateLoad(int64Ty, valuePtr(call->getArgOperand(1)));
+            Value* rhs = immediate ? call->getArgOperand(2) : body.CreateLoad(int64Ty, valuePtr(call->getArgOperand(2)));
+            bool isAdd = (kind == CATAddOp) || (kind == CATAddImmOp);
+            body.CreateStore(isAdd ? body.CreateAdd(lhs, rhs) : body.CreateSub(lhs, rhs), valuePtr(call->getArgOperand(0)));
+        }
+        body.CreateBr(tail);
 
-        std::unordered_map<Instruction*, Value*> llvmFoldedConstants;
-        bool modified = false;
-        bool flag = true;
-        while(flag){
-            flag = false;
-            llvmFoldedConstants.clear();
+        if(!checked){
+            if(result != NULL) call->replaceAllUsesWith(result);
+            call->eraseFromParent();
+        }
+        else if(result != NULL){
+            PHINode* phi = PHINode::Create(int64Ty, 2, "cat.value", &tail->front());
+            call->replaceAllUsesWith(phi);
+            phi->addIncoming(result, fast);
+            phi->addIncoming(call, slow);
+        }
+    }
+
+
+    bool isLocalCATObject(CallInst* def){ //Reached only through its SSA value: no phis, stores, returns or escaping callee params
+        for(auto &U : def->uses()){
+            User* user = U.getUser();
+            CATOpKind useKind = getOpKind(user);
+            if(useKind == CATFreeOp) return false; //lifetime already managed
+            if(isCATOp(useKind)) continue;
+            if(auto call = dyn_cast<CallInst>(user)){
+                if(isNonEscapingParam(call->getCalledFunction(), U.getOperandNo())) continue;
+            }
+            return false;
+        }
+        return true;
+    }
+
+
+    void computeCATLiveness(Function &F, std::vector<CallInst*> &objs, std::unordered_map<Instruction*, unsigned> &objIndex,
+                            std::unordered_map<BasicBlock*, llvm::BitVector> &liveIn, std::unordered_map<BasicBlock*, llvm::BitVector> &liveOut){
+        std::unordered_map<BasicBlock*, llvm::BitVector> useBB, defBB;
+        for(auto &bb : F){
+            useBB[&bb] = llvm::BitVector(objs.size());
+            defBB[&bb] = llvm::BitVector(objs.size());
+            liveIn[&bb] = llvm::BitVector(objs.size());
+            liveOut[&bb] = llvm::BitVector(objs.size());
+        }
+        for(unsigned idx = 0; idx < objs.size(); idx++){
+            defBB[objs[idx]->getParent()].set(idx);
+            for(auto user : objs[idx]->users()){
+                BasicBlock* useBlock = cast<Instruction>(user)->getParent();
+                if(useBlock != objs[idx]->getParent()) useBB[useBlock].set(idx); //the definition dominates, so same-block uses follow it
+            }
+        }
+
+        bool changed = true;
+        while(changed){ //backward, to a fixed point
+            changed = false;
+            for(auto bb : post_order(&F)){
+                llvm::BitVector out(objs.size());
+                for(auto succ : successors(bb)) out |= liveIn[succ];
+                llvm::BitVector in = defBB[bb];
+                in.flip();
+                in &= out;
+                in |= useBB[bb];
+                if((in != liveIn[bb]) || (out != liveOut[bb])){
+                    liveIn[bb] = in;
+                    liveOut[bb] = out;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+
+    bool poolConstantCATs(Module &M){ //One shared CAT object per constant, created by a global constructor
+
+        std::map<int64_t, std::vector<CallInst*>> pool; //ordered, so globals are emitted deterministically
+        for(auto &F : M){
+            if(F.isDeclaration() || !reachableFuncs.count(&F)) continue;
+            if(!CATFuncs.count(&F)) continue;
             for(auto &bb : F){
                 for(auto &i : bb){
-                    Constant* const1 = ConstantFoldInstruction(&i, *DL);
-                    if(const1 != NULL){                  
-                        llvmFoldedConstants[&i] = const1;
-                        continue;                                 
-                    }
+                    if(getOpKind(&i) != CATNewOp) continue;
+                    ConstantInt* constant = getImmutableConstant(&i);
+                    if(constant == NULL) continue;
+                    pool[constant->getSExtValue()].push_back(cast<CallInst>(&i));
                 }
             }
-            for(auto &i : llvmFoldedConstants){
-                errs()<<"\n Replaced all uses of instruction: "; 
-                i.first->print(errs());     
-                errs()<<" using ConstantFoldInstruction() Libcall";            
-                BasicBlock::iterator ii(i.first);
-                ReplaceInstWithValue(i.first->getParent()->getInstList(), ii, i.second);
-                modified = true;
-                flag = true;                   
+        }
+
+        for(auto it = pool.begin(); it != pool.end(); ){ //a single CAT_new that runs once gains nothing
+            bool repeated = (it->second.size() > 1);
+            for(auto def : it->second){
+                Function* F = def->getFunction();
+                if((F != mainF) || (getAnalysis<LoopInfoWrapperPass>(*F).getLoopInfo().getLoopFor(def->getParent()) != NULL)) repeated = true;
             }
-        }  
-        return modified;   
+            if(repeated) ++it;
+            else it = pool.erase(it);
+        }
+        if(pool.empty()) return false;
+
+        LLVMContext &ctx = M.getContext();
+        Type* handleTy = CAT_new->getReturnType();
+        Function* initF = Function::Create(FunctionType::get(Type::getVoidTy(ctx), false), GlobalValue::InternalLinkage, "CAT_pool_init", &M);
+        IRBuilder<>initBuilder(BasicBlock::Create(ctx, "entry", initF));
+        for(auto &entry : pool){
+            auto GV = new GlobalVariable(M, handleTy, false, GlobalValue::InternalLinkage,
+                ConstantPointerNull::get(cast<PointerType>(handleTy)), "CAT_pool." + Twine(entry.first));
+            Value* handle = initBuilder.CreateCall(CAT_new, ArrayRef<Value *>(ConstantInt::get(IntegerType::get(ctx, 64), entry.first)));
+            initBuilder.CreateStore(handle, GV);
+            for(auto def : entry.second){
+                errs()<<"\nPooling constant CAT object: ";
+                def->print(errs());
+                IRBuilder<>builder(def);
+                Value* pooled = builder.CreateLoad(handleTy, GV);
+                pooled->takeName(def);
+                def->replaceAllUsesWith(pooled);
+                def->eraseFromParent();
+                NumConstantsPooled++;
+            }
+        }
+        initBuilder.CreateRetVoid();
+        appendToGlobalCtors(M, initF, 0);
+        return true;
     }
 
 
-    bool deleteCondBrs(Function &F){
-        std::unordered_map<Instruction*,  unsigned> condBranches;
+    bool deadCodeElimination(Function &F){ //Path-insensitive worklist DCE 
+
+        bool modified = false;
+        FunctionSummary* sumF = summaryNode[&F];
+        std::vector<Instruction *> worklist;
+        std::unordered_set<Instruction *> deleted;
+        std::unordered_map<Instruction *, unsigned> liveReads; //CAT_get users and source-operand uses of each CAT_new
+        std::unordered_set<Instruction *> aliasReads; //CAT_news whose may/must aliases are read by a CAT_get
+
         for(auto &bb : F){
             for(auto &i : bb){
-                if(auto branchInst = dyn_cast<BranchInst>(&i)){
-                    if(branchInst->isUnconditional()) continue;
-                    if(auto constInt = dyn_cast<ConstantInt>(branchInst->getCondition())){
-                        bool branchTarget = false;
-                        if(constInt->isZero())
-                            branchTarget = true;
-                        condBranches[branchInst] = branchTarget;
-                        BasicBlock* succToRemove = branchInst->getSuccessor(!branchTarget);
-                        succToRemove->removePredecessor(&bb);
-                        
+                if(getOpKind(&i) == CATNewOp){
+                    unsigned reads = 0;
+                    for (auto &U : i.uses()) {
+                        CATOpKind useKind = getOpKind(U.getUser());
+                        if(useKind == CATGetOp){
+                            reads++;
+                        }
+                        else if(isCATRedef(useKind)){
+                            if(cast<CallInst>(U.getUser())->getArgOperand(CATOpTable[useKind].destOperand) != &i) reads++;
+                        }
                     }
-                } 
+                    liveReads[&i] = reads;
+
+                    if (sumF->mayMustAliases.find(&i) != sumF->mayMustAliases.end()){
+                        for (auto aliasInst : sumF->mayMustAliases[&i]){
+                            for (auto &AliasUser : aliasInst->uses()) {
+                                if(getOpKind(AliasUser.getUser()) == CATGetOp){
+                                    aliasReads.insert(&i);
+                                    break;
+                                }
+                            }
+                        }
+                    }
+                }
+                if(isa<CallInst>(&i) || isa<PHINode>(&i)){
+                    worklist.push_back(&i);
+                }
             }
         }
 
-        if(condBranches.empty()) return false;
-        
-        for(auto &i : condBranches){
-            IRBuilder<>builder(i.first);
-            BranchInst *branch = dyn_cast<BranchInst>(i.first);
-            errs()<<"\nChanging cond branch "; 
-            branch->print(errs()); 
-            Instruction* uncondBranch =  cast<Instruction>(builder.CreateBr(branch->getSuccessor(i.second)));
-            errs()<<"\t to Uncond: ";
-            uncondBranch->print(errs());
-        }
-        for(auto &i : condBranches){
-            i.first->eraseFromParent();
+        auto eraseDead = [&](Instruction* I){ //erase I and revisit the operands whose use count dropped
+            errs()<<"\n Deleted instruction: ";
+            I->print(errs());
+            errs()<<"  by DCE";
+            CATOpKind kind = getOpKind(I);
+            if(isCATRedef(kind)){
+                CallInst* redef = cast<CallInst>(I);
+                Value* dest = redef->getArgOperand(CATOpTable[kind].destOperand);
+                for(auto &op : redef->arg_operands()){
+                    auto reads = liveReads.find(dyn_cast<Instruction>(op.get()));
+                    if((op.get() == dest) || (reads == liveReads.end())) continue;
+                    reads->second--;
+                }
+            }
+            std::vector<Instruction *> operands;
+            for(auto &op : I->operands()){
+                if(auto opInst = dyn_cast<Instruction>(op.get())) operands.push_back(opInst);
+            }
+            deleted.insert(I);
+            I->eraseFromParent();
+            NumDeadInstructions++;
+            modified = true;
+            for(auto opInst : operands){
+                if(!deleted.count(opInst)) worklist.push_back(opInst);
+            }
+        };
+
+        while(!worklist.empty()){
+            Instruction* I = worklist.back();
+            worklist.pop_back();
+            if(deleted.count(I)) continue;
+
+            if(CallInst *callInst = dyn_cast<CallInst>(I)){
+                CATOpKind kind = getOpKind(callInst);
+                if(!isCATOp(kind)){
+                    if (isDeadCall(callInst)){
+                        eraseDead(callInst);
+                    }
+                }
+                else if(kind == CATNewOp){
+                    if(callInst->getNumUses() == 0){
+                        eraseDead(callInst);
+                    }
+                    else if((liveReads[callInst] == 0) && !aliasReads.count(callInst)){ //never read: its redefinitions are dead
+                        std::set<Instruction *> redefs;
+                        for (auto &U : callInst->uses()) {
+                            CATOpKind useKind = getOpKind(U.getUser());
+                            if(isCATRedef(useKind) || (useKind == CATFreeOp)) redefs.insert(cast<Instruction>(U.getUser()));
+                        }
+                        for(auto redef : redefs){
+                            eraseDead(redef);
+                        }
+                    }
+                }
+            }
+            else if(PHINode *PHIInst = dyn_cast<PHINode>(I)){
+                if(PHIInst->getNumUses() == 0){
+                    eraseDead(PHIInst);
+                }   
+            }
         }
-        bool changed = true;
-        while(changed){
-            changed = false;
-            std::set<BasicBlock*> toDeleteBBs;
-            for(auto &bb : F){
-                if(&(F.getEntryBlock()) == &bb) continue;
-                if((bb.hasNPredecessors(0)) || (bb.getSinglePredecessor() == &bb)){
-                    //bb.replaceSuccessorsPhiUsesWith(&(F.getEntryBlock()));
-                    for (int i = 0; i< bb.getTerminator()->getNumSuccessors(); i++){
-                        BasicBlock* PredBB = bb.getTerminator()->getSuccessor(i);
-                        PredBB->removePredecessor(&bb);
-                        for(auto &i : *PredBB){
-                            if(auto phi = dyn_cast<PHINode>(&i)){  
-                                if(phi->getBasicBlockIndex(&bb) < 0) continue;
-                                phi->removeIncomingValue(&bb, true);
-                            }
+
+        return modified;
+    }
+
+    bool isDeadCall(CallInst* callInst){
+        Function* calleeF = callInst->getCalledFunction();
+        if(calleeF == NULL) return false; //skip indirect calls
+        if(calleeF->isDeclaration()) return false;
+        if(callInst->getNumUses() != 0) return false;
+        auto effects = funcEffects.find(calleeF);
+        if(effects == funcEffects.end()) return false;
+        return effects->second.isPure(); //recursion is folded into mayNotReturn
+    }
+
+
+    void computeFunctionEffects(Module &M){ //Bottom-up over the call graph SCCs so callees are summarised before their callers
+        funcEffects.clear();
+        for(auto sccIt = scc_begin(CG); !sccIt.isAtEnd(); ++sccIt){
+            std::vector<Function*> sccFuncs;
+            for(auto node : *sccIt){
+                Function* F = node->getFunction();
+                if((F == NULL) || F->isDeclaration()) continue;
+                sccFuncs.push_back(F);
+                funcEffects[F] = FunctionEffects();
+            }
+            if(sccFuncs.empty()) continue;
+            bool recursive = (sccIt->size() > 1);
+            for(auto &callRecord : *(sccIt->front())){
+                if(callRecord.second == sccIt->front()) recursive = true; //direct self-recursion
+            }
+            bool changed = true;
+            while(changed){ //effects only grow, members of a recursive SCC see each other's current summary
+                changed = false;
+                for(auto F : sccFuncs){
+                    FunctionEffects effects = computeLocalEffects(*F);
+                    effects.mayNotReturn |= recursive;
+                    if(effects != funcEffects[F]){
+                        funcEffects[F] = effects;
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
+
+
+    FunctionEffects computeLocalEffects(Function &F){
+        FunctionEffects effects;
+        for(auto &bb : F){
+            for(auto &i : bb){
+                if(auto store = dyn_cast<StoreInst>(&i)){
+                    if(!isa<AllocaInst>(getBaseObject(store->getPointerOperand()))) effects.writesMemory = true;
+                }
+                else if(auto call = dyn_cast<CallInst>(&i)){
+                    CATOpKind kind = getOpKind(call);
+                    if(isCATRedef(kind)){
+                        addCATOrigins(call->getArgOperand(CATOpTable[kind].destOperand), effects);
+                        continue;
+                    }
+                    if(kind == CATFreeOp){
+                        addCATOrigins(call->getArgOperand(0), effects);
+                        continue;
+                    }
+                    if(isCATOp(kind)) continue;
+                    if(isa<DbgInfoIntrinsic>(call)) continue;
+                    if(isBatchCall(call)){ //handles come from memory, so any CAT object may be one of them
+                        effects.writesMemory = true;
+                        effects.modifiesUnknownCAT = true;
+                        continue;
+                    }
+                    Function* calleeF = call->getCalledFunction();
+                    if(calleeF == NULL){ //indirect calls may reach anything
+                        effects.writesMemory = true;
+                        effects.mayNotReturn = true;
+                        effects.modifiesUnknownCAT = true;
+                        continue;
+                    }
+                    if(calleeF->doesNotAccessMemory() || calleeF->onlyReadsMemory()) continue;
+                    if(calleeF->isDeclaration()){ //I/O and library state, and whatever CAT handles it is given
+                        effects.writesMemory = true;
+                        for(auto &arg : call->arg_operands()){
+                            if(arg->getType()->isPointerTy()) addCATOrigins(arg, effects);
                         }
+                        continue;
                     }
+                    auto calleeEffects = funcEffects.find(calleeF);
+                    if(calleeEffects == funcEffects.end()){
+                        effects.writesMemory = true;
+                        effects.mayNotReturn = true;
+                        effects.modifiesUnknownCAT = true;
+                        continue;
+                    }
+                    effects.writesMemory |= calleeEffects->second.writesMemory;
+                    effects.mayNotReturn |= calleeEffects->second.mayNotReturn;
+                    effects.modifiesUnknownCAT |= calleeEffects->second.modifiesUnknownCAT;
+                    for(auto argNo : calleeEffects->second.modifiedCATArgs){
+                        if(argNo < call->getNumArgOperands()) addCATOrigins(call->getArgOperand(argNo), effects);
+                    }
+                }
+                else if(!isa<LoadInst>(&i) && i.mayHaveSideEffects()){ //fences, atomics, va_arg
+                    effects.writesMemory = true;
                 }
             }
-            for(auto &bb : F){
-                if(&(F.getEntryBlock()) == &bb) continue;
-                if((bb.hasNPredecessors(0)) || (bb.getSinglePredecessor() == &bb)){
-                    toDeleteBBs.insert(&bb);
-                    changed = true;
+        }
+        for(auto &arg : F.args()){
+            effects.paramEffects.push_back(arg.getType()->isPointerTy() ? computeParamEffects(&arg) : 0);
+        }
+        return effects;
+    }
+
+
+    uint8_t computeParamEffects(Argument* arg){ //Follows the handle through casts and phis, callee parameters come from their summaries
+        uint8_t paramEffects = 0;
+        std::vector<Value*> worklist;
+        std::unordered_set<Value*> visited;
+        worklist.push_back(arg);
+        while(!worklist.empty()){
+            Value* cur = worklist.back();
+            worklist.pop_back();
+            if(!visited.insert(cur).second) continue;
+            for(auto &U : cur->uses()){
+                User* user = U.getUser();
+                if(isa<BitCastInst>(user) || isa<PHINode>(user) || isa<SelectInst>(user)){
+                    worklist.push_back(user);
+                }
+                else if(auto call = dyn_cast<CallInst>(user)){
+                    CATOpKind kind = getOpKind(call);
+                    if(kind == CATFreeOp){
+                        paramEffects |= ParamWritten | ParamEscapes; //the caller must neither use nor free it afterwards
+                        continue;
+                    }
+                    if(isCATOp(kind)){
+                        if(CATOpTable[kind].destOperand == (int8_t)U.getOperandNo()) paramEffects |= ParamWritten;
+                        else paramEffects |= ParamRead;
+                        continue;
+                    }
+                    if(isa<DbgInfoIntrinsic>(call)) continue;
+                    Function* calleeF = call->getCalledFunction();
+                    auto calleeEffects = (calleeF == NULL) ? funcEffects.end() : funcEffects.find(calleeF);
+                    unsigned argNo = U.getOperandNo();
+                    if((calleeEffects == funcEffects.end()) || (argNo >= calleeEffects->second.paramEffects.size())){
+                        paramEffects |= ParamEscapes; //external, indirect or variadic
+                        continue;
+                    }
+                    paramEffects |= ParamPassed | calleeEffects->second.paramEffects[argNo];
+                }
+                else if(isa<LoadInst>(user)){
+                    paramEffects |= ParamRead;
+                }
+                else if(auto store = dyn_cast<StoreInst>(user)){
+                    if(store->getValueOperand() == cur) paramEffects |= ParamEscapes;
+                    else paramEffects |= ParamWritten;
+                }
+                else if(!isa<ICmpInst>(user)){
+                    paramEffects |= ParamEscapes; //returned, GEPs, int casts, ...
                 }
             }
+        }
+        return paramEffects;
+    }
 
-            for(auto bb : toDeleteBBs){
-                bb->eraseFromParent();
-                changed = true;
+
+    Value* getBaseObject(Value* ptr){
+        while(true){
+            ptr = ptr->stripPointerCasts();
+            if(auto gep = dyn_cast<GEPOperator>(ptr)){
+                ptr = gep->getPointerOperand();
+                continue;
             }
+            return ptr;
         }
-        return true;
+    }
+
+
+    void addCATOrigins(Value* v, FunctionEffects &effects){ //Which CAT objects visible to the caller may v (or the memory it points to) refer to
+        std::vector<Value*> worklist;
+        std::unordered_set<Value*> visited;
+        worklist.push_back(v);
+        while(!worklist.empty()){
+            Value* cur = getBaseObject(worklist.back());
+            worklist.pop_back();
+            if(!visited.insert(cur).second) continue;
+            if(isa<ConstantData>(cur)) continue;
+            if(getOpKind(cur) == CATNewOp) continue; //created by this function, the caller cannot hold it yet
+            if(auto arg = dyn_cast<Argument>(cur)){
+                effects.modifiedCATArgs.insert(arg->getArgNo());
+            }
+            else if(auto GV = dyn_cast<GlobalVariable>(cur)){
+                if(!GV->isConstant()) effects.modifiesUnknownCAT = true;
+            }
+            else if(auto load = dyn_cast<LoadInst>(cur)){
+                worklist.push_back(load->getPointerOperand());
+            }
+            else if(auto phi = dyn_cast<PHINode>(cur)){
+                for(auto &incoming : phi->incoming_values()) worklist.push_back(incoming);
+            }
+            else if(auto select = dyn_cast<SelectInst>(cur)){
+                worklist.push_back(select->getTrueValue());
+                worklist.push_back(select->getFalseValue());
+            }
+            else if(isa<AllocaInst>(cur)){ //a local slot only holds what is stored into it, unless its address leaks
+                for(auto user : cur->users()){
+                    if(auto store = dyn_cast<StoreInst>(user)){
+                        if(store->getValueOperand() == cur) effects.modifiesUnknownCAT = true;
+                        else worklist.push_back(store->getValueOperand());
+                    }
+                    else if(!isa<LoadInst>(user)){
+                        effects.modifiesUnknownCAT = true;
+                    }
+                }
+            }
+            else{
+                effects.modifiesUnknownCAT = true; //returned by a call, int-to-pointer, ...
+            }
+        }
+    }
+
+
+    bool callMayModifyCAT(CallInst* call, Value* catVar){ //catVar NULL asks about any CAT object of the caller
+        Function* calleeF = call->getCalledFunction();
+        if(calleeF == NULL) return true;
+        if(isBatchCall(call)) return true;
+        auto effects = funcEffects.find(calleeF);
+        if(effects == funcEffects.end()) return !calleeF->isDeclaration();
+        if(effects->second.modifiesUnknownCAT) return true;
+        for(auto argNo : effects->second.modifiedCATArgs){
+            if(argNo >= call->getNumArgOperands()) continue;
+            if(catVar == NULL) return true;
+            Value* arg = call->getArgOperand(argNo)->stripPointerCasts();
+            if(isa<ConstantData>(arg)) continue;
+            if((arg != catVar) && (getOpKind(arg) == CATNewOp)) continue; //a different CAT object
+            return true;
+        }
+        return false;
+    }
+
+
+
+    bool constantFoldnonCAT(Function &F){ //Worklist folding: a replaced instruction only requeues its users
+
+        bool modified = false;
+        std::vector<Instruction*> worklist;
+        std::unordered_set<Instruction*> queued;
+        for(auto &bb : F){
+            for(auto &i : bb){
+                worklist.push_back(&i);
+                queued.insert(&i);
+            }
+        }
+        std::reverse(worklist.begin(), worklist.end()); //visit in program order so operands fold first
+
+        const SimplifyQuery SQ(*DL);
+        while(!worklist.empty()){
+            Instruction* I = worklist.back();
+            worklist.pop_back();
+            queued.erase(I);
+
+            Value* folded = ConstantFoldInstruction(I, *DL);
+            const char* how = "ConstantFoldInstruction() Libcall";
+            if((folded == NULL) && !I->mayHaveSideEffects()){
+                folded = SimplifyInstruction(I, SQ.getWithInstruction(I)); //x - x, x * 1, ...
+                how = "SimplifyInstruction()";
+            }
+            if((folded == NULL) || (folded == I)) continue;
+
+            errs()<<"\n Replaced all uses of instruction: "; 
+            I->print(errs());     
+            errs()<<" using "<<how;            
+            for(auto user : I->users()){
+                auto userInst = dyn_cast<Instruction>(user);
+                if((userInst == NULL) || (userInst == I)) continue;
+                if(queued.insert(userInst).second) worklist.push_back(userInst);
+            }
+            BasicBlock::iterator ii(I);
+            ReplaceInstWithValue(I->getParent()->getInstList(), ii, folded);
+            modified = true;
+        }  
+        return modified;   
+    }
+
+
+    bool foldTerminators(Function &F){ //Fold constant terminators and selects, drop unreachable regions, merge straight-line blocks
+
+        bool modified = false;
+        DomTreeUpdater DTU(DomTreeUpdater::UpdateStrategy::Lazy); //no tree to keep up to date, only the deferred block deletion
+
+        for(auto &bb : F){
+            for(auto ii = bb.begin(); ii != bb.end(); ){
+                auto selectInst = dyn_cast<SelectInst>(&*ii++);
+                if(selectInst == NULL) continue;
+                auto constCond = dyn_cast<ConstantInt>(selectInst->getCondition());
+                if(constCond == NULL) continue;
+                errs()<<"\nFolding select "; 
+                selectInst->print(errs()); 
+                selectInst->replaceAllUsesWith(constCond->isZero() ? selectInst->getFalseValue() : selectInst->getTrueValue());
+                selectInst->eraseFromParent();
+                modified = true;
+            }
+
+            auto term = bb.getTerminator();
+            if(auto branchInst = dyn_cast<BranchInst>(term)){
+                if(branchInst->isUnconditional()) continue;
+            }
+            else if(!isa<SwitchInst>(term)) continue;
+            if(ConstantFoldTerminator(&bb, true, nullptr, &DTU)){ //br/switch on a constant, or to a single destination
+                errs()<<"\nFolded terminator of "<<bb.getName()<<" to ";
+                bb.getTerminator()->print(errs());
+                modified = true;
+            }
+        }
+
+        df_iterator_default_set<BasicBlock*, 32> reachable; //one DFS from the entry block
+        for(auto bb : depth_first_ext(&F.getEntryBlock(), reachable)) (void)bb;
+        std::vector<BasicBlock*> deadBBs;
+        for(auto &bb : F){
+            if(!reachable.count(&bb)) deadBBs.push_back(&bb);
+        }
+        for(auto bb : deadBBs){
+            for(auto succ : successors(bb)){
+                if(reachable.count(succ)) succ->removePredecessor(bb);
+            }
+            bb->dropAllReferences(); //dead regions may branch to each other
+        }
+        for(auto bb : deadBBs){
+            errs()<<"\nDeleting unreachable block "<<bb->getName();
+            DTU.deleteBB(bb);
+            NumBlocksDeleted++;
+            modified = true;
+        }
+
+        std::vector<BasicBlock*> straightLine;
+        for(auto &bb : F){
+            BasicBlock* pred = bb.getSinglePredecessor();
+            if((pred == NULL) || (pred == &bb)) continue;
+            if(pred->getSingleSuccessor() != &bb) continue;
+            straightLine.push_back(&bb);
+        }
+        for(auto bb : straightLine){
+            if(MergeBlockIntoPredecessor(bb, &DTU)){
+                NumBlocksDeleted++;
+                modified = true;
+            }
+        }
+        DTU.flush(); //erases the deleted blocks
+
+        return modified;
     }
 
 
@@ -1793,6 +3797,8 @@ namespace {
       AU.addRequired<LoopInfoWrapperPass>();
       AU.addRequired<ScalarEvolutionWrapperPass>();
       AU.addRequired<TargetTransformInfoWrapperPass>();
+      AU.addRequired<BlockFrequencyInfoWrapperPass>();
+      AU.addRequired<ProfileSummaryInfoWrapperPass>();
       //AU.setPreservesAll();
     }
   };
@@ -15,6 +15,22 @@ void CAT_add (CATData result, const CATData v1, const CATData v2);
 
 void CAT_sub (CATData result, const CATData v1, const CATData v2);
 
+void CAT_add_imm (CATData result, const CATData v1, int64_t v2);
+
+void CAT_sub_imm (CATData result, const CATData v1, int64_t v2);
+
+void CAT_add_atomic (CATData result, const CATData v1, const CATData v2);
+
+void CAT_sub_atomic (CATData result, const CATData v1, const CATData v2);
+
+void CAT_get_array (int64_t *out, const CATData *v, int64_t n);
+
+void CAT_add_array (CATData *result, const CATData *v1, const CATData *v2, int64_t n);
+
+void CAT_sub_array (CATData *result, const CATData *v1, const CATData *v2, int64_t n);
+
+void CAT_free (CATData v);
+
 const int64_t CAT_invocations (void);
 
 #endif
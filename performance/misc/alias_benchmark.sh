@@ -0,0 +1,10 @@
+#!/bin/bash
+
+cd test0 ;
+for alias in aa pta ; do
+  echo "#### CAT alias sets from: $alias" ;
+  make clean &> /dev/null ;
+  make CAT_ALIAS=$alias ITERS=3 ;
+  echo "" ;
+done
+make clean &> /dev/null ;
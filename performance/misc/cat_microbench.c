@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "CAT.h"
+
+#define DEFAULT_OPS		10000000
+
+static double elapsed_ns (struct timespec *start){
+	struct timespec	end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+static void report (const char *op, struct timespec *start, int64_t ops){
+	printf("%-12s %8.2f ns/op\n", op, elapsed_ns(start) / ops);
+}
+
+int main (int argc, char *argv[]){
+	struct timespec	start;
+	int64_t			ops;
+	int64_t			sink	= 0;
+	int64_t			i;
+
+	ops	= (argc > 1) ? atoll(argv[1]) : DEFAULT_OPS;
+
+	CATData x	= CAT_new(1);
+	CATData y	= CAT_new(2);
+	CATData r	= CAT_new(0);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ops / 10; i++){ /* every object stays live, keep the footprint bounded */
+		sink	+= (int64_t) (CAT_new(i) != NULL);
+	}
+	report("CAT_new", &start, ops / 10);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ops; i++){
+		sink	+= CAT_get(x);
+	}
+	report("CAT_get", &start, ops);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ops; i++){
+		CAT_set(x, i);
+	}
+	report("CAT_set", &start, ops);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ops; i++){
+		CAT_add(r, x, y);
+	}
+	report("CAT_add", &start, ops);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ops; i++){
+		CAT_sub(r, x, y);
+	}
+	report("CAT_sub", &start, ops);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ops; i++){
+		CAT_add_imm(r, x, i);
+	}
+	report("CAT_add_imm", &start, ops);
+
+	printf("checksum %ld, CAT invocations = %ld\n", sink + CAT_get(r), CAT_invocations());
+
+	return 0;
+}
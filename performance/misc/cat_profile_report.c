@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * Lists the hottest CAT call sites of a profile written by a -DCAT_PROFILE build of CAT.c.
+ *
+ *   cat_profile_report PROFILE [PROGRAM [TOP]]
+ *
+ * Records of the same site and CAT function (one per thread) are merged. With PROGRAM, sites are symbolized
+ * through addr2line; compile the program with -g to get source lines as well as function names.
+ */
+
+#define PROFILE_MAGIC		"CATPROF1"
+#define PROFILE_OP_SIZE		16
+#define DEFAULT_TOP			20
+
+typedef struct {
+	uint64_t	address;
+	uint64_t	count;
+	char		op[PROFILE_OP_SIZE];
+} profile_record_t;
+
+static int compare_site (const void *a, const void *b){
+	const profile_record_t	*r1	= (const profile_record_t *) a;
+	const profile_record_t	*r2	= (const profile_record_t *) b;
+
+	if (r1->address != r2->address) return (r1->address < r2->address) ? -1 : 1;
+	return strncmp(r1->op, r2->op, PROFILE_OP_SIZE);
+}
+
+static int compare_count (const void *a, const void *b){
+	const profile_record_t	*r1	= (const profile_record_t *) a;
+	const profile_record_t	*r2	= (const profile_record_t *) b;
+
+	if (r1->count != r2->count) return (r1->count > r2->count) ? -1 : 1;
+	return compare_site(a, b);
+}
+
+static void print_location (const char *program, uint64_t address){
+	char	command[4096];
+	char	function[1024];
+	char	location[1024];
+	FILE	*p;
+
+	snprintf(command, sizeof(command), "addr2line -f -C -e '%s' 0x%llx", program, (unsigned long long) (address - 1));	/* inside the call instruction */
+	p	= popen(command, "r");
+	if (p == NULL) return ;
+	if (fgets(function, sizeof(function), p) && fgets(location, sizeof(location), p)){
+		function[strcspn(function, "\n")]	= '\0';
+		location[strcspn(location, "\n")]	= '\0';
+		printf("  %s %s", function, location);
+	}
+	pclose(p);
+
+	return ;
+}
+
+int main (int argc, char *argv[]){
+	profile_record_t	*records;
+	char				magic[8];
+	uint64_t			n;
+	uint64_t			sites;
+	uint64_t			total	= 0;
+	uint64_t			i;
+	const char			*program;
+	uint64_t			top;
+	FILE				*f;
+
+	if (argc < 2){
+		fprintf(stderr, "USAGE: %s PROFILE [PROGRAM [TOP]]\n", argv[0]);
+		return 1;
+	}
+	program	= (argc > 2) ? argv[2] : NULL;
+	top		= (argc > 3) ? strtoull(argv[3], NULL, 10) : DEFAULT_TOP;
+
+	f	= fopen(argv[1], "rb");
+	if (f == NULL){
+		fprintf(stderr, "ERROR: cannot open %s\n", argv[1]);
+		return 1;
+	}
+	if ((fread(magic, 1, 8, f) != 8) || (memcmp(magic, PROFILE_MAGIC, 8) != 0) || (fread(&n, sizeof(n), 1, f) != 1)){
+		fprintf(stderr, "ERROR: %s is not a CAT profile\n", argv[1]);
+		return 1;
+	}
+	records	= (profile_record_t *) malloc(sizeof(profile_record_t) * (n + 1));
+	if (fread(records, sizeof(profile_record_t), n, f) != n){
+		fprintf(stderr, "ERROR: %s is truncated\n", argv[1]);
+		return 1;
+	}
+	fclose(f);
+
+	qsort(records, n, sizeof(profile_record_t), compare_site);		/* merge the per-thread records */
+	sites	= 0;
+	for (i = 0; i < n; i++){
+		total	+= records[i].count;
+		if ((sites > 0) && (compare_site(&records[sites - 1], &records[i]) == 0)){
+			records[sites - 1].count	+= records[i].count;
+			continue;
+		}
+		records[sites++]	= records[i];
+	}
+	qsort(records, sites, sizeof(profile_record_t), compare_count);
+
+	printf("CAT invocations: %llu from %llu call sites\n", (unsigned long long) total, (unsigned long long) sites);
+	for (i = 0; (i < sites) && (i < top); i++){
+		printf("%12llu %6.2f%%  %-15s 0x%llx", (unsigned long long) records[i].count, (total > 0) ? (100.0 * records[i].count) / total : 0.0,
+				records[i].op, (unsigned long long) records[i].address);
+		if (program != NULL) print_location(program, records[i].address);
+		printf("\n");
+	}
+	free(records);
+
+	return 0;
+}
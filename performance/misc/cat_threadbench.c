@@ -0,0 +1,66 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+#include "CAT.h"
+
+#define DEFAULT_OPS		2000000
+#define MAX_THREADS		64
+
+static int64_t	ops_per_thread;
+static CATData	shared;
+
+static void * worker (void *arg){
+	CATData		x	= CAT_new(1);
+	CATData		y	= CAT_new(2);
+	CATData		one	= CAT_new(1);
+	int64_t		i;
+
+	for (i = 0; i < ops_per_thread; i++){
+		CAT_add(x, x, y);						/* private objects, plain variant */
+		if ((i & 15) == 0){
+			CAT_add_atomic(shared, shared, one);	/* shared object, atomic variant */
+		}
+	}
+	*((int64_t *) arg)	= CAT_get(x);
+
+	return NULL;
+}
+
+int main (int argc, char *argv[]){
+	pthread_t		threads[MAX_THREADS];
+	int64_t			results[MAX_THREADS];
+	struct timespec	start;
+	struct timespec	end;
+	int				nthreads;
+	int				t;
+
+	ops_per_thread	= (argc > 1) ? atoll(argv[1]) : DEFAULT_OPS;
+
+	for (nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2){
+		int64_t	before	= CAT_invocations();
+		int64_t	expected;
+		int64_t	counted;
+		double	seconds;
+
+		shared	= CAT_new(0);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (t = 0; t < nthreads; t++){
+			pthread_create(&threads[t], NULL, worker, &results[t]);
+		}
+		for (t = 0; t < nthreads; t++){
+			pthread_join(threads[t], NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		counted		= CAT_invocations() - before;
+
+		seconds		= (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		expected	= 1 + nthreads * (3 + ops_per_thread + (ops_per_thread + 15) / 16 + 1);
+		printf("%2d threads: %8.2f Mops/s, shared = %ld (expected %ld), invocations %s\n",
+				nthreads, nthreads * ops_per_thread / seconds / 1e6,
+				CAT_get(shared), nthreads * ((ops_per_thread + 15) / 16),
+				(counted == expected) ? "match" : "MISMATCH");
+	}
+
+	return 0;
+}
@@ -0,0 +1,23 @@
+#!/bin/bash
+
+RUNS=${1:-5} ;
+
+cd test0 ;
+make program_optimized.bc &> /dev/null ;
+for runtime in CAT CAT_handles ; do
+  echo "#### CAT runtime layout: $runtime" ;
+  rm -f program_optimized ;
+  make CAT_RUNTIME=../misc/$runtime.bc program_optimized &> /dev/null ;
+  if which perf &> /dev/null ; then
+    perf stat -r $RUNS -e task-clock,cache-references,cache-misses ./program_optimized 2>&1 > /dev/null | grep -E "task-clock|cache|elapsed" ;
+  else
+    totalTime="0" ;
+    for i in `seq 1 $RUNS` ; do
+      time=`/usr/bin/time -f "%e" ./program_optimized 2>&1 > /dev/null | tail -n 1` ;
+      totalTime=`echo "$totalTime + $time" | bc` ;
+    done
+    echo "Time: `echo "scale=3; $totalTime / $RUNS" | bc` seconds (perf not found, no cache-miss counts)" ;
+  fi
+  echo "" ;
+done
+make clean &> /dev/null ;
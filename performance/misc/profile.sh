@@ -0,0 +1,13 @@
+#!/bin/bash
+
+TOP=${1:-20} ;
+
+cd test0 ;
+make program_optimized.bc &> /dev/null ;
+rm -f program_optimized ;
+make CAT_RUNTIME=../misc/CAT_profile.o program_optimized &> /dev/null ;
+CAT_PROFILE_FILE=cat.profile ./program_optimized > /dev/null ;
+clang -O2 ../misc/cat_profile_report.c -o ../misc/cat_profile_report ;
+../misc/cat_profile_report cat.profile ./program_optimized $TOP ;
+rm -f cat.profile ../misc/cat_profile_report ;
+make clean &> /dev/null ;
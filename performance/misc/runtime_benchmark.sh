@@ -0,0 +1,17 @@
+#!/bin/bash
+
+OPS=${1:-10000000} ;
+CC=${CC:-clang} ;
+CFLAGS=${CFLAGS:--O3} ;
+
+cd misc ;
+for variant in "default:" "fast:-DCAT_FAST" "unchecked:-DCAT_UNCHECKED" "handles:-DCAT_HANDLES" ; do
+  name=${variant%%:*} ;
+  flags=${variant#*:} ;
+  echo "#### CAT runtime: $name" ;
+  $CC $CFLAGS $flags -c CAT.c -o CAT_bench.o ;
+  $CC $CFLAGS cat_microbench.c CAT_bench.o -o cat_microbench ;
+  ./cat_microbench $OPS ;
+  echo "" ;
+done
+rm -f CAT_bench.o cat_microbench ;
@@ -0,0 +1,15 @@
+#!/bin/bash
+
+OPS=${1:-2000000} ;
+
+cd misc ;
+for variant in "threaded:-DCAT_THREADED" "threaded fast:-DCAT_THREADED -DCAT_FAST" ; do
+  name=${variant%%:*} ;
+  flags=${variant#*:} ;
+  echo "#### CAT runtime: $name" ;
+  clang -O3 -pthread $flags -c CAT.c -o CAT_bench.o ;
+  clang -O3 -pthread cat_threadbench.c CAT_bench.o -o cat_threadbench ;
+  ./cat_threadbench $OPS ;
+  echo "" ;
+done
+rm -f CAT_bench.o cat_threadbench ;
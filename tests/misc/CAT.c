@@ -1,8 +1,139 @@
+#ifdef CAT_PROFILE
+#define _GNU_SOURCE		/* dl_iterate_phdr */
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "CAT.h"
 
+/*
+ * Build modes:
+ *   default            malloc per object, two validation strings checked on every access
+ *   -DCAT_FAST         objects carved out of slabs, a single 64-bit magic word checked on every access
+ *   -DCAT_UNCHECKED    as CAT_FAST, without any check on access
+ *   -DCAT_HANDLES      handles are an index plus a generation tag into a contiguous value array,
+ *                      checked by comparing the generation (skipped with CAT_UNCHECKED)
+ *   -DCAT_THREADED     safe to call from several threads (combines with CAT_FAST/CAT_UNCHECKED): per-thread
+ *                      invocation counters summed by CAT_invocations, per-thread slabs
+ *   -DCAT_PROFILE      combines with any mode: invocations are also counted per call site and CAT function in a
+ *                      per-thread hash table, dumped at exit to $CAT_PROFILE_FILE (default cat.profile). Link it as
+ *                      an object file, not bitcode, so the CAT functions are not inlined into their call sites
+ */
+#define BATCH_CHUNK		64		/* handles validated ahead of each run of the array operations */
+
+#if defined(CAT_UNCHECKED) && !defined(CAT_FAST)
+#define CAT_FAST
+#endif
+
+#if defined(CAT_THREADED) && defined(CAT_HANDLES)
+#error "CAT_THREADED does not support CAT_HANDLES: the handle table grows with realloc"
+#endif
+
+#ifdef CAT_THREADED
+
+#include <pthread.h>
+
+#define CACHE_LINE_SIZE		64
+#define THREAD_LOCAL		__thread
+
+typedef struct invocation_counter {
+	int64_t						count;		/* written by its owner thread only */
+	struct invocation_counter	*next;
+	char						padding[CACHE_LINE_SIZE - sizeof(int64_t) - sizeof(void *)];
+} invocation_counter_t;
+
+static invocation_counter_t				*counters = NULL;	/* never freed, so counts outlive their threads */
+static pthread_mutex_t					counters_lock = PTHREAD_MUTEX_INITIALIZER;
+static THREAD_LOCAL invocation_counter_t	*thread_counter = NULL;
+
+#define ADD_INVOCATIONS(n)	internal_count_invocation(n)
+
+#else
+
+#define THREAD_LOCAL
+#define ADD_INVOCATIONS(n)	CAT_invocation_count += (n)
+
+#endif
+
+#ifdef CAT_PROFILE
+
+#include <link.h>
+
+#define PROFILE_MAGIC			"CATPROF1"
+#define PROFILE_OP_SIZE			16
+#define PROFILE_INITIAL_SITES	256		/* per thread, a power of two */
+
+typedef struct {
+	const void	*site;		/* return address into the caller */
+	const char	*op;		/* __func__ of the CAT function, compared by address */
+	int64_t		count;
+} profile_entry_t;
+
+typedef struct profile_table {
+	profile_entry_t			*entries;
+	size_t					capacity;
+	size_t					used;
+	struct profile_table	*next;
+} profile_table_t;
+
+typedef struct {				/* file layout: PROFILE_MAGIC, a uint64_t record count, the records */
+	uint64_t	address;		/* of the call site in the executable file, as addr2line expects it */
+	uint64_t	count;
+	char		op[PROFILE_OP_SIZE];
+} profile_record_t;
+
+static profile_table_t				*profile_tables = NULL;		/* never freed, so they are dumped after their threads exit */
+static THREAD_LOCAL profile_table_t	*thread_profile = NULL;
+
+static void internal_profile_site (const char *op, const void *site, int64_t n);
+
+#define PROFILE_SITE(n)		internal_profile_site(__func__, __builtin_return_address(0), n)
+
+#else
+
+#define PROFILE_SITE(n)
+
+#endif
+
+#define COUNT_INVOCATIONS(n)	do { ADD_INVOCATIONS(n); PROFILE_SITE(n); } while (0)	/* in the CAT function itself, for the return address */
+#define COUNT_INVOCATION()		COUNT_INVOCATIONS(1)
+
+#if defined(CAT_HANDLES)
+
+#define HANDLE_INDEX(h)			((uint32_t) ((uintptr_t) (h)) - 1)	/* index 0 is encoded as 1, so no handle is NULL */
+#define HANDLE_GENERATION(h)	((uint32_t) (((uintptr_t) (h)) >> 32))
+#define INITIAL_HANDLES			4096
+
+typedef struct {
+	int64_t		value;
+} internal_data_t;
+
+static internal_data_t	*values = NULL;			/* structure of arrays: values and generations share the index */
+static uint32_t			*generations = NULL;
+static uint32_t			handles_used = 0;
+static uint32_t			handles_capacity = 0;
+static uint32_t			*free_handles = NULL;	/* indices released by CAT_free, reused first */
+static uint32_t			free_handles_count = 0;
+
+#elif defined(CAT_FAST)
+
+#define VALID_MAGIC			0x7036706262556c70ULL	/* "p6pbbUlp" */
+#define SLAB_OBJECTS		4096
+
+typedef struct internal_data {
+	uint64_t	magic;
+	union {
+		int64_t					value;
+		struct internal_data	*next_free;		/* while on the free list */
+	};
+} internal_data_t;
+
+static THREAD_LOCAL internal_data_t	*slab = NULL;
+static THREAD_LOCAL size_t			slab_available = 0;
+static THREAD_LOCAL internal_data_t	*free_list = NULL;	/* objects released by CAT_free */
+
+#else
+
 #define VALID_STRING 		"p6pbbUlpLo0BL1bM2k8K"
 #define VALID_STRING_SIZE	20
 
@@ -12,27 +143,35 @@ typedef struct {
 	char	end_validation_string[VALID_STRING_SIZE];
 } internal_data_t;
 
-static int64_t invocations = 0;
+#endif
 
-static internal_data_t * internal_check_data (CATData v);
+#if !defined(CAT_THREADED) && defined(CAT_FAST) && !defined(CAT_HANDLES)
+int64_t CAT_invocation_count = 0;			/* exported: code lowered by CatPass -cat-lower counts inline */
+#elif !defined(CAT_THREADED)
+static int64_t CAT_invocation_count = 0;	/* kept private, so lowered code fails to link against another layout */
+#endif
+
+static inline internal_data_t * internal_check_data (CATData v);
+static inline internal_data_t * internal_alloc_data (void);
+static inline CATData internal_handle_of (internal_data_t *d);
+#ifdef CAT_THREADED
+static inline void internal_count_invocation (int64_t n);
+#endif
 
 CATData CAT_new (int64_t value){
 	internal_data_t		*d;
 
-  invocations++;
-
-	d			= (internal_data_t *) malloc(sizeof(internal_data_t));
+  COUNT_INVOCATION();
 
-	strncpy(d->begin_validation_string, VALID_STRING, VALID_STRING_SIZE);
-	strncpy(d->end_validation_string, VALID_STRING, VALID_STRING_SIZE);
+	d			= internal_alloc_data();
 	d->value	= value;
 
-	return (CATData) d;
+	return internal_handle_of(d);
 }
 
 const int64_t CAT_get (const CATData v) {
 	internal_data_t	*d;
-  invocations++;
+  COUNT_INVOCATION();
 
 	d	= internal_check_data(v);
 
@@ -42,7 +181,7 @@ const int64_t CAT_get (const CATData v) {
 void CAT_set (CATData v, int64_t value){
 	internal_data_t	*d;
 
-  invocations++;
+  COUNT_INVOCATION();
 	d	= internal_check_data(v);
 
     d->value = value;
@@ -54,7 +193,7 @@ void CAT_sub (CATData result, const CATData v1, const CATData v2){
 	internal_data_t		*d1;
 	internal_data_t		*d2;
 	internal_data_t		*dresult;
-  invocations++;
+  COUNT_INVOCATION();
 
   if (v1 == NULL || v2 == NULL) return;
 
@@ -71,7 +210,7 @@ void CAT_add (CATData result, const CATData v1, const CATData v2){
 	internal_data_t		*d1;
 	internal_data_t		*d2;
 	internal_data_t		*dresult;
-  invocations++;
+  COUNT_INVOCATION();
 
   if (v1 == NULL || v2 == NULL) return;
 	d1				= internal_check_data(v1);
@@ -83,13 +222,404 @@ void CAT_add (CATData result, const CATData v1, const CATData v2){
 	return ;
 }
 
-static internal_data_t * internal_check_data (CATData v){
+void CAT_sub_imm (CATData result, const CATData v1, int64_t v2){
+	internal_data_t		*d1;
+	internal_data_t		*dresult;
+  COUNT_INVOCATION();
+
+  if (v1 == NULL) return;
+
+	d1				= internal_check_data(v1);
+	dresult			= internal_check_data(result);
+
+	dresult->value	= d1->value - v2;
+
+	return ;
+}
+
+void CAT_add_imm (CATData result, const CATData v1, int64_t v2){
+	internal_data_t		*d1;
+	internal_data_t		*dresult;
+  COUNT_INVOCATION();
+
+  if (v1 == NULL) return;
+	d1				= internal_check_data(v1);
+	dresult			= internal_check_data(result);
+
+	dresult->value	= d1->value + v2;
+
+	return ;
+}
+
+void CAT_sub_atomic (CATData result, const CATData v1, const CATData v2){
+	internal_data_t		*d1;
+	internal_data_t		*d2;
+	internal_data_t		*dresult;
+  COUNT_INVOCATION();
+
+  if (v1 == NULL || v2 == NULL) return;
+
+	d1				= internal_check_data(v1);
+	d2				= internal_check_data(v2);
+	dresult			= internal_check_data(result);
+
+	if (dresult == d1){
+		__atomic_fetch_sub(&dresult->value, __atomic_load_n(&d2->value, __ATOMIC_RELAXED), __ATOMIC_SEQ_CST);
+	} else if (dresult == d2){	/* result = v1 - result: no fetch-and-op, retry until no update comes in between */
+		int64_t	old	= __atomic_load_n(&dresult->value, __ATOMIC_RELAXED);
+		int64_t	updated;
+
+		do {
+			updated	= __atomic_load_n(&d1->value, __ATOMIC_RELAXED) - old;
+		} while (!__atomic_compare_exchange_n(&dresult->value, &old, updated, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+	} else {
+		__atomic_store_n(&dresult->value, __atomic_load_n(&d1->value, __ATOMIC_RELAXED) - __atomic_load_n(&d2->value, __ATOMIC_RELAXED), __ATOMIC_SEQ_CST);
+	}
+
+	return ;
+}
+
+void CAT_add_atomic (CATData result, const CATData v1, const CATData v2){
+	internal_data_t		*d1;
+	internal_data_t		*d2;
+	internal_data_t		*dresult;
+  COUNT_INVOCATION();
+
+  if (v1 == NULL || v2 == NULL) return;
+	d1				= internal_check_data(v1);
+	d2				= internal_check_data(v2);
+	dresult			= internal_check_data(result);
+
+	if (dresult == d1){
+		__atomic_fetch_add(&dresult->value, __atomic_load_n(&d2->value, __ATOMIC_RELAXED), __ATOMIC_SEQ_CST);
+	} else if (dresult == d2){
+		__atomic_fetch_add(&dresult->value, __atomic_load_n(&d1->value, __ATOMIC_RELAXED), __ATOMIC_SEQ_CST);
+	} else {
+		__atomic_store_n(&dresult->value, __atomic_load_n(&d1->value, __ATOMIC_RELAXED) + __atomic_load_n(&d2->value, __ATOMIC_RELAXED), __ATOMIC_SEQ_CST);
+	}
+
+	return ;
+}
+
+/*
+ * Array operations: element i behaves as the scalar call on the i-th handles, in increasing i, and counts as one
+ * invocation. Handles are validated a chunk at a time so the arithmetic runs as a tight loop.
+ */
+void CAT_get_array (int64_t *out, const CATData *v, int64_t n){
+	int64_t	i;
+
+  if (n <= 0) return;
+  COUNT_INVOCATIONS(n);
+
+	for (i = 0; i < n; i++){
+		out[i]	= internal_check_data(v[i])->value;
+	}
+
+	return ;
+}
+
+static inline void internal_array_op (CATData *result, const CATData *v1, const CATData *v2, int64_t n, int subtract){
+	internal_data_t		*d1[BATCH_CHUNK];
+	internal_data_t		*d2[BATCH_CHUNK];
+	internal_data_t		*dresult[BATCH_CHUNK];
+	int64_t				base;
+	int64_t				chunk;
+	int64_t				i;
+
+	for (base = 0; base < n; base += BATCH_CHUNK){
+		chunk	= ((n - base) < BATCH_CHUNK) ? (n - base) : BATCH_CHUNK;
+
+		for (i = 0; i < chunk; i++){
+			if (v1[base + i] == NULL || v2[base + i] == NULL){ /* skipped, as by CAT_add/CAT_sub */
+				dresult[i]	= NULL;
+				continue;
+			}
+			d1[i]		= internal_check_data(v1[base + i]);
+			d2[i]		= internal_check_data(v2[base + i]);
+			dresult[i]	= internal_check_data(result[base + i]);
+		}
+
+		if (subtract){
+			for (i = 0; i < chunk; i++){
+				if (dresult[i] == NULL) continue;
+				dresult[i]->value	= d1[i]->value - d2[i]->value;
+			}
+		} else {
+			for (i = 0; i < chunk; i++){
+				if (dresult[i] == NULL) continue;
+				dresult[i]->value	= d1[i]->value + d2[i]->value;
+			}
+		}
+	}
+
+	return ;
+}
+
+void CAT_add_array (CATData *result, const CATData *v1, const CATData *v2, int64_t n){
+  if (n <= 0) return;
+  COUNT_INVOCATIONS(n);
+
+	internal_array_op(result, v1, v2, n, 0);
+}
+
+void CAT_sub_array (CATData *result, const CATData *v1, const CATData *v2, int64_t n){
+  if (n <= 0) return;
+  COUNT_INVOCATIONS(n);
+
+	internal_array_op(result, v1, v2, n, 1);
+}
+
+void CAT_free (CATData v){ /* memory management, not counted as an invocation */
 	internal_data_t	*d;
 
+  if (v == NULL) return;
+
+	d	= internal_check_data(v);
+
+#if defined(CAT_HANDLES)
+	d->value	= 0;
+	generations[HANDLE_INDEX(v)]++;		/* stale handles no longer validate */
+	free_handles[free_handles_count++]	= HANDLE_INDEX(v);
+#elif defined(CAT_FAST)
+	d->magic		= 0;
+	d->next_free	= free_list;
+	free_list		= d;
+#else
+	memset(d->begin_validation_string, 0, VALID_STRING_SIZE);
+	free(d);
+#endif
+
+	return ;
+}
+
+#ifdef CAT_THREADED
+static invocation_counter_t * internal_register_counter (void){
+	invocation_counter_t	*c;
+
+	c			= (invocation_counter_t *) aligned_alloc(CACHE_LINE_SIZE, sizeof(invocation_counter_t));
+	c->count	= 0;
+
+	pthread_mutex_lock(&counters_lock);
+	c->next		= counters;
+	counters	= c;
+	pthread_mutex_unlock(&counters_lock);
+
+	thread_counter	= c;
+
+	return c;
+}
+
+static inline void internal_count_invocation (int64_t n){
+	invocation_counter_t	*c;
+
+	c	= thread_counter;
+	if (c == NULL){
+		c	= internal_register_counter();
+	}
+	__atomic_store_n(&c->count, c->count + n, __ATOMIC_RELAXED);
+
+	return ;
+}
+#endif
+
+#ifdef CAT_PROFILE
+static int internal_profile_load_bias (struct dl_phdr_info *info, size_t size, void *data){
+	*(uintptr_t *) data	= (uintptr_t) info->dlpi_addr;	/* the executable comes first: 0 unless it is position independent */
+
+	return 1;
+}
+
+static void internal_profile_dump (void){
+	profile_table_t		*t;
+	profile_record_t	record;
+	const char			*path;
+	FILE				*f;
+	uint64_t			records	= 0;
+	uintptr_t			bias	= 0;
+	size_t				i;
+
+	path	= getenv("CAT_PROFILE_FILE");
+	if (path == NULL) path = "cat.profile";
+	f		= fopen(path, "wb");
+	if (f == NULL){
+		fprintf(stderr, "libCAT: ERROR = cannot write the profile to %s\n", path);
+		return ;
+	}
+
+	for (t = profile_tables; t != NULL; t = t->next){
+		records	+= t->used;
+	}
+	fwrite(PROFILE_MAGIC, 1, 8, f);
+	fwrite(&records, sizeof(records), 1, f);
+	dl_iterate_phdr(internal_profile_load_bias, &bias);
+
+	for (t = profile_tables; t != NULL; t = t->next){
+		for (i = 0; i < t->capacity; i++){
+			if (t->entries[i].site == NULL) continue;
+			memset(&record, 0, sizeof(record));
+			record.address	= (uint64_t) ((uintptr_t) t->entries[i].site - bias);
+			record.count	= (uint64_t) t->entries[i].count;
+			strncpy(record.op, t->entries[i].op, PROFILE_OP_SIZE - 1);
+			fwrite(&record, sizeof(record), 1, f);
+		}
+	}
+	fclose(f);
+
+	return ;
+}
+
+static profile_table_t * internal_profile_table (void){
+	static int		dump_registered	= 0;
+	profile_table_t	*t;
+
+	t				= (profile_table_t *) malloc(sizeof(profile_table_t));
+	t->capacity		= PROFILE_INITIAL_SITES;
+	t->used			= 0;
+	t->entries		= (profile_entry_t *) calloc(t->capacity, sizeof(profile_entry_t));
+
+#ifdef CAT_THREADED
+	pthread_mutex_lock(&counters_lock);
+#endif
+	t->next			= profile_tables;
+	profile_tables	= t;
+	if (!dump_registered){
+		dump_registered	= 1;
+		atexit(internal_profile_dump);
+	}
+#ifdef CAT_THREADED
+	pthread_mutex_unlock(&counters_lock);
+#endif
+
+	thread_profile	= t;
+
+	return t;
+}
+
+static inline profile_entry_t * internal_profile_slot (profile_entry_t *entries, size_t capacity, const char *op, const void *site){
+	uint64_t	h;
+	size_t		i;
+
+	h	= ((uint64_t) (uintptr_t) site ^ ((uint64_t) (uintptr_t) op << 17)) * 0x9E3779B97F4A7C15ULL;
+	for (i = (size_t) (h >> 32) & (capacity - 1); ; i = (i + 1) & (capacity - 1)){		/* linear probing */
+		if (entries[i].site == NULL) return &entries[i];
+		if (entries[i].site == site && entries[i].op == op) return &entries[i];
+	}
+}
+
+static void internal_profile_site (const char *op, const void *site, int64_t n){
+	profile_table_t	*t;
+	profile_entry_t	*e;
+	profile_entry_t	*old;
+	size_t			old_capacity;
+	size_t			i;
+
+	t	= thread_profile;
+	if (t == NULL){
+		t	= internal_profile_table();
+	}
+
+	e	= internal_profile_slot(t->entries, t->capacity, op, site);
+	if (e->site == NULL){
+		if (2 * (t->used + 1) > t->capacity){		/* keep the load under one half */
+			old				= t->entries;
+			old_capacity	= t->capacity;
+			t->capacity		*= 2;
+			t->entries		= (profile_entry_t *) calloc(t->capacity, sizeof(profile_entry_t));
+			for (i = 0; i < old_capacity; i++){
+				if (old[i].site == NULL) continue;
+				*internal_profile_slot(t->entries, t->capacity, old[i].op, old[i].site)	= old[i];
+			}
+			free(old);
+			e	= internal_profile_slot(t->entries, t->capacity, op, site);
+		}
+		e->site	= site;
+		e->op	= op;
+		t->used++;
+	}
+	e->count	+= n;
+
+	return ;
+}
+#endif
+
+static inline internal_data_t * internal_alloc_data (void){
+	internal_data_t	*d;
+
+#if defined(CAT_HANDLES)
+	if (free_handles_count > 0){
+		return &values[free_handles[--free_handles_count]];
+	}
+	if (handles_used == handles_capacity){
+		handles_capacity	= (handles_capacity == 0) ? INITIAL_HANDLES : handles_capacity * 2;
+		values				= (internal_data_t *) realloc(values, sizeof(internal_data_t) * handles_capacity);
+		generations			= (uint32_t *) realloc(generations, sizeof(uint32_t) * handles_capacity);
+		free_handles		= (uint32_t *) realloc(free_handles, sizeof(uint32_t) * handles_capacity);
+	}
+	generations[handles_used]	= 1;
+	d							= &values[handles_used++];
+#elif defined(CAT_FAST)
+	if (free_list != NULL){
+		d				= free_list;
+		free_list		= d->next_free;
+		d->magic		= VALID_MAGIC;
+		return d;
+	}
+	if (slab_available == 0){
+		slab			= (internal_data_t *) malloc(sizeof(internal_data_t) * SLAB_OBJECTS);
+		slab_available	= SLAB_OBJECTS;
+	}
+	d				= slab++;
+	slab_available--;
+
+	d->magic		= VALID_MAGIC;
+#else
+	d			= (internal_data_t *) malloc(sizeof(internal_data_t));
+
+	strncpy(d->begin_validation_string, VALID_STRING, VALID_STRING_SIZE);
+	strncpy(d->end_validation_string, VALID_STRING, VALID_STRING_SIZE);
+#endif
+
+	return d;
+}
+
+static inline CATData internal_handle_of (internal_data_t *d){
+#if defined(CAT_HANDLES)
+	uint32_t	index	= (uint32_t) (d - values);
+
+	return (CATData) ((((uintptr_t) generations[index]) << 32) | (uintptr_t) (index + 1));
+#else
+	return (CATData) d;
+#endif
+}
+
+static inline internal_data_t * internal_check_data (CATData v){
+	internal_data_t	*d;
+
+#ifndef CAT_UNCHECKED
 	if (v == NULL){
 		fprintf(stderr, "libCAT: ERROR = input is NULL\n");
 		abort();
 	}
+#endif
+
+#if defined(CAT_HANDLES)
+	d	= &values[HANDLE_INDEX(v)];
+#ifndef CAT_UNCHECKED
+	if ( (HANDLE_INDEX(v) >= handles_used)		||
+			 (generations[HANDLE_INDEX(v)] != HANDLE_GENERATION(v))		  ){
+		fprintf(stderr, "libCAT: ERROR = data has been corrupted\n");
+		abort();
+	}
+#endif
+#elif defined(CAT_FAST)
+	d	= (internal_data_t *) v;
+#ifndef CAT_UNCHECKED
+	if (d->magic != VALID_MAGIC){
+		fprintf(stderr, "libCAT: ERROR = data has been corrupted\n");
+		abort();
+	}
+#endif
+#else
 	d	= (internal_data_t *) v;
 
 	if ( (strncmp(d->begin_validation_string, VALID_STRING, VALID_STRING_SIZE) != 0)		||
@@ -97,10 +627,24 @@ static internal_data_t * internal_check_data (CATData v){
 		fprintf(stderr, "libCAT: ERROR = data has been corrupted\n");
 		abort();
 	}
+#endif
 
 	return d;
 }
 
 const int64_t CAT_invocations (void){
-  return invocations;
+#ifdef CAT_THREADED
+	invocation_counter_t	*c;
+	int64_t					total	= 0;
+
+	pthread_mutex_lock(&counters_lock);
+	for (c = counters; c != NULL; c = c->next){
+		total	+= __atomic_load_n(&c->count, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&counters_lock);
+
+	return total;
+#else
+  return CAT_invocation_count;
+#endif
 }
@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include "CAT.h"
+
+static CATData make_value (int n){
+	CATData	d;
+
+	if (n <= 0){
+		return CAT_new(1);
+	}
+	d	= make_value(n - 1);
+
+	return CAT_new(CAT_get(d) * 2);
+}
+
+int main (int argc, char *argv[]){
+	CATData	r;
+
+	r	= make_value(argc + 2);
+	printf("Before add:	Value = %ld\n", CAT_get(r));
+
+	CAT_add(r, r, r);
+	printf("After add:	Value = %ld\n", CAT_get(r));
+
+  printf("CAT invocations = %ld\n", CAT_invocations());
+	return 0;
+}
@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include "CAT.h"
+
+static void mirror (CATData x){
+	CATData	limit;
+
+	limit	= CAT_new(100);
+	CAT_sub(x, limit, x);
+
+	return ;
+}
+
+static void offset (CATData x){
+	CATData	limit;
+
+	limit	= CAT_new(100);
+	CAT_sub(x, limit, x);
+	CAT_add(x, x, limit);
+
+	return ;
+}
+
+int main (int argc, char *argv[]){
+	CATData	x;
+
+	x	= CAT_new(argc);
+	mirror(x);
+	printf("Mirrored:	Value = %ld\n", CAT_get(x));
+
+	offset(x);
+	printf("Offset:	Value = %ld\n", CAT_get(x));
+
+	mirror(x);
+	printf("Mirrored:	Value = %ld\n", CAT_get(x));
+
+  printf("CAT invocations = %ld\n", CAT_invocations());
+	return 0;
+}
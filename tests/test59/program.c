@@ -0,0 +1,19 @@
+#include <stdio.h>
+#include "CAT.h"
+
+int main (int argc, char *argv[]){
+	CATData	sum;
+	CATData	scratch;
+	int		i;
+
+	sum	= CAT_new(0);
+	for (i = 0; i < (argc + 19); i++){
+		scratch	= CAT_new(i);
+		CAT_add(scratch, scratch, scratch);
+		CAT_add(sum, sum, scratch);
+	}
+	printf("Sum:	Value = %ld\n", CAT_get(sum));
+
+  printf("CAT invocations = %ld\n", CAT_invocations());
+	return 0;
+}
@@ -0,0 +1,18 @@
+#include <stdio.h>
+#include "CAT.h"
+
+int main (int argc, char *argv[]){
+	CATData	first;
+	CATData	second;
+
+	first	= CAT_new(argc);
+	CAT_add(first, first, first);
+	printf("First:	Value = %ld\n", CAT_get(first));
+
+	second	= CAT_new(argc + 5);
+	CAT_add(second, second, second);
+	printf("Second:	Value = %ld\n", CAT_get(second));
+
+  printf("CAT invocations = %ld\n", CAT_invocations());
+	return 0;
+}
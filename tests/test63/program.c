@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <stdint.h>
+#include "CAT.h"
+
+#define SIZE 16
+
+CATData	r[SIZE];
+CATData	a[SIZE];
+CATData	b[SIZE];
+int64_t	out[SIZE];
+
+static void print_out (const char *name, int n){
+	int	i;
+
+	printf("%s:", name);
+	for (i = 0; i <= n; i++){
+		printf(" %ld", out[i]);
+	}
+	printf("\n");
+
+	return ;
+}
+
+int main (int argc, char *argv[]){
+	int	n;
+	int	i;
+
+	n	= argc + 7;
+	for (i = 0; i <= n; i++){
+		a[i]	= CAT_new(i * 3);
+		b[i]	= CAT_new(i - 4);
+		r[i]	= CAT_new(0);
+	}
+
+	i	= 0;
+	do {
+		CAT_add(r[i], a[i], b[i]);
+	} while (i++ < n);
+
+	i	= 0;
+	do {
+		out[i]	= CAT_get(r[i]);
+	} while (i++ < n);
+	print_out("Sums", n);
+
+	i	= 0;
+	do {
+		CAT_sub(r[i], a[i], b[i]);
+	} while (i++ < n);
+
+	i	= 0;
+	do {
+		out[i]	= CAT_get(r[i]);
+	} while (i++ < n);
+	print_out("Differences", n);
+
+  printf("CAT invocations = %ld\n", CAT_invocations());
+	return 0;
+}